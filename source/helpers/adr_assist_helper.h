@@ -0,0 +1,173 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ADR_ASSIST_HELPER_H
+#define _ADR_ASSIST_HELPER_H
+
+#include "mbed.h"
+
+/**
+ * Application side data rate tracking.
+ *
+ * The stack does not tell the application which data rate ADR selected, the
+ * TX metadata of each uplink does. After every TX_DONE the data rate and time
+ * on air of that uplink are recorded, so the application can:
+ *
+ * - compose the next payload for the maximum payload of that data rate. The
+ *   stack truncates payloads that do not fit, a few bytes are kept free for
+ *   piggybacked MAC answers.
+ * - stretch the uplink interval so the uplinks stay within an airtime budget
+ *   per hour when the data rate drops, and return to the configured interval
+ *   when it rises again.
+ *
+ * A data rate change requested by the network server applies to the next
+ * uplink, the application sees it one uplink later.
+ *
+ * Maximum payloads follow the Mbed OS region tables (no dwell time limit).
+ */
+
+#define ADR_ASSIST_AIRTIME_BUDGET   MBED_CONF_APP_ADR_AIRTIME_BUDGET   // ms per hour, 0 keeps the interval
+#define ADR_ASSIST_FOPTS_RESERVE    4
+#define ADR_ASSIST_DATA_RATES       16
+#define ADR_ASSIST_DR_UNKNOWN       0xff
+
+typedef struct {
+    uint32_t uplinks;
+    uint32_t bytes;
+    uint32_t airtime_ms;
+    uint32_t time_ms;           // Time this was the data rate in use
+} adr_assist_stats_t;
+
+static const uint8_t adr_assist_payload_us915[ADR_ASSIST_DATA_RATES]   = { 11, 53, 125, 242, 242, 0, 0, 0, 53, 129, 242, 242, 242, 242, 0, 0 };
+static const uint8_t adr_assist_payload_au915[ADR_ASSIST_DATA_RATES]   = { 51, 51, 51, 115, 242, 242, 242, 0, 53, 129, 242, 242, 242, 242, 0, 0 };
+static const uint8_t adr_assist_payload_default[ADR_ASSIST_DATA_RATES] = { 51, 51, 51, 115, 242, 242, 242, 242, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+static const uint8_t     *adr_assist_payload = adr_assist_payload_default;
+static adr_assist_stats_t adr_assist_stats[ADR_ASSIST_DATA_RATES];
+static LowPowerTimer      adr_assist_timer;
+static uint8_t            adr_assist_dr = ADR_ASSIST_DR_UNKNOWN;
+static uint32_t           adr_assist_dr_since_ms = 0;
+static uint32_t           adr_assist_toa_ms = 0;
+static uint32_t           adr_assist_changes = 0;
+static uint8_t            adr_assist_pending = 0;
+
+// region is the lora.phy name
+void adr_assist_init(const char *region)
+{
+    if((strcmp(region, "US915") == 0) || (strcmp(region, "US915_HYBRID") == 0))
+        adr_assist_payload = adr_assist_payload_us915;
+    else if(strcmp(region, "AU915") == 0)
+        adr_assist_payload = adr_assist_payload_au915;
+    else
+        adr_assist_payload = adr_assist_payload_default;
+
+    memset(adr_assist_stats, 0, sizeof(adr_assist_stats));
+    adr_assist_timer.start();
+}
+
+// Maximum application payload of the data rate in use, before the first
+// uplink the lowest data rate is assumed
+uint8_t adr_assist_max_payload()
+{
+    uint8_t dr = (adr_assist_dr == ADR_ASSIST_DR_UNKNOWN) ? 0 : adr_assist_dr;
+    uint8_t max = adr_assist_payload[dr];
+
+    return (max > ADR_ASSIST_FOPTS_RESERVE) ? max - ADR_ASSIST_FOPTS_RESERVE : max;
+}
+
+// Data rate of the last uplink, ADR_ASSIST_DR_UNKNOWN before the first one
+uint8_t adr_assist_data_rate()
+{
+    return adr_assist_dr;
+}
+
+// Interval in seconds that keeps the uplinks within the airtime budget, never below interval_s
+uint32_t adr_assist_interval(uint32_t interval_s)
+{
+    if((ADR_ASSIST_AIRTIME_BUDGET == 0) || (adr_assist_toa_ms == 0))
+        return interval_s;
+
+    uint32_t budget_s = (uint32_t)(((uint64_t)adr_assist_toa_ms * 3600 + ADR_ASSIST_AIRTIME_BUDGET - 1) / ADR_ASSIST_AIRTIME_BUDGET);
+
+    return (budget_s > interval_s) ? budget_s : interval_s;
+}
+
+// Payload bytes handed to the stack
+void adr_assist_sent(uint8_t size)
+{
+    adr_assist_pending = size;
+}
+
+// The uplink failed, its bytes were not delivered
+void adr_assist_tx_failed()
+{
+    adr_assist_pending = 0;
+}
+
+// TX_DONE with the data rate and time on air from the TX metadata
+void adr_assist_tx_done(uint8_t dr, uint32_t toa_ms)
+{
+    uint32_t now = adr_assist_timer.read_ms();
+
+    if(dr >= ADR_ASSIST_DATA_RATES)
+        return;
+
+    if(adr_assist_dr != ADR_ASSIST_DR_UNKNOWN)
+        adr_assist_stats[adr_assist_dr].time_ms += now - adr_assist_dr_since_ms;
+    adr_assist_dr_since_ms = now;
+
+    if(dr != adr_assist_dr)
+    {
+        if(adr_assist_dr != ADR_ASSIST_DR_UNKNOWN)
+            adr_assist_changes++;
+        adr_assist_dr = dr;
+        printf("Data rate DR%u, max payload %u bytes, airtime %lu ms\n", dr, adr_assist_max_payload(), toa_ms);
+    }
+
+    adr_assist_stats[dr].uplinks++;
+    adr_assist_stats[dr].bytes += adr_assist_pending;
+    adr_assist_stats[dr].airtime_ms += toa_ms;
+    adr_assist_toa_ms = toa_ms;
+    adr_assist_pending = 0;
+}
+
+void adr_assist_print_stats(uint32_t interval_s)
+{
+    uint32_t now = adr_assist_timer.read_ms();
+
+    if(adr_assist_dr == ADR_ASSIST_DR_UNKNOWN)
+        printf("Data Rate             : unknown, no uplink yet\n");
+    else
+        printf("Data Rate             : DR%u, max payload %u bytes, airtime %lu ms, %lu changes\n",
+            adr_assist_dr, adr_assist_max_payload(), adr_assist_toa_ms, adr_assist_changes);
+    printf("Uplink Interval       : %lu s (configured %lu s, budget %u ms/hour)\n",
+        adr_assist_interval(interval_s), interval_s, ADR_ASSIST_AIRTIME_BUDGET);
+
+    printf("%-4s %8s %8s %10s %10s\n", "DR", "uplinks", "bytes", "airtime", "time");
+    for(uint8_t dr = 0; dr < ADR_ASSIST_DATA_RATES; dr++)
+    {
+        const adr_assist_stats_t &stats = adr_assist_stats[dr];
+        uint32_t time_ms = stats.time_ms + ((dr == adr_assist_dr) ? now - adr_assist_dr_since_ms : 0);
+
+        if((stats.uplinks == 0) && (time_ms == 0))
+            continue;
+
+        printf("DR%-2u %8lu %8lu %7lu ms %8lu s\n", dr, stats.uplinks, stats.bytes, stats.airtime_ms, time_ms / 1000);
+    }
+}
+
+#endif // _ADR_ASSIST_HELPER_H
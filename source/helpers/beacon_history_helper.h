@@ -0,0 +1,267 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BEACON_HISTORY_HELPER_H
+#define _BEACON_HISTORY_HELPER_H
+
+#include "mbed.h"
+#include "lorawan_types.h"
+
+/**
+ * Class B beacon history.
+ *
+ * Keeps the GPS time of the last received beacons against the local low power
+ * clock and estimates the local crystal drift (least squares slope) and the
+ * arrival jitter (RMS of the residuals). The gateway specific field of each
+ * beacon is decoded and cached, with lock and miss counts per gateway.
+ */
+
+#define BEACON_HISTORY_SIZE         MBED_CONF_APP_BEACON_HISTORY_SIZE
+#define BEACON_GW_CACHE_SIZE        MBED_CONF_APP_BEACON_GW_CACHE_SIZE
+#define BEACON_GW_SPECIFIC_SIZE     sizeof(((loramac_beacon_t *)0)->gw_specific)
+
+// Gateway specific InfoDesc values
+#define BEACON_INFO_GPS_ANTENNA_MAX 2
+#define BEACON_INFO_NETID_GWID      3
+
+typedef struct {
+    uint32_t beacon_time;       // GPS seconds
+    uint64_t local_us;          // Local clock at reception
+} beacon_sample_t;
+
+// InfoDesc and 6 bytes of info, see beacon_gateway_print()
+MBED_STATIC_ASSERT(BEACON_GW_SPECIFIC_SIZE >= 7, "Beacon gateway specific field too short");
+
+typedef struct {
+    uint8_t  gw_specific[BEACON_GW_SPECIFIC_SIZE];
+    uint32_t locks;
+    uint32_t misses;
+    uint32_t last_beacon_time;
+} beacon_gateway_t;
+
+static beacon_sample_t  beacon_samples[BEACON_HISTORY_SIZE];
+static uint8_t          beacon_sample_head  = 0;
+static uint8_t          beacon_sample_count = 0;
+static beacon_gateway_t beacon_gateways[BEACON_GW_CACHE_SIZE];
+static uint8_t          beacon_gateway_count = 0;
+static int              beacon_gateway_current = -1;
+static LowPowerTimer    beacon_clock;
+
+// Estimates, updated on every beacon
+static int32_t          beacon_drift_ppm_x100 = 0;
+static uint32_t         beacon_jitter_us      = 0;
+
+void beacon_history_init()
+{
+    beacon_clock.start();
+}
+
+static uint32_t beacon_isqrt(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit  = (uint64_t)1 << 62;
+
+    while(bit > value)
+        bit >>= 2;
+
+    while(bit != 0)
+    {
+        if(value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)root;
+}
+
+static void beacon_history_estimate()
+{
+    const beacon_sample_t &first = beacon_samples[(beacon_sample_head + BEACON_HISTORY_SIZE - beacon_sample_count) % BEACON_HISTORY_SIZE];
+    int64_t sum_dx = 0, sum_dy = 0, sum_dxdy = 0, sum_dx2 = 0;
+    int64_t n = beacon_sample_count;
+
+    if(n < 2)
+        return;
+
+    for(uint8_t i = 0; i < beacon_sample_count; i++)
+    {
+        const beacon_sample_t &s = beacon_samples[(beacon_sample_head + BEACON_HISTORY_SIZE - beacon_sample_count + i) % BEACON_HISTORY_SIZE];
+        int64_t dx = s.beacon_time - first.beacon_time;
+        int64_t dy = s.local_us - first.local_us;
+
+        sum_dx   += dx;
+        sum_dy   += dy;
+        sum_dxdy += dx * dy;
+        sum_dx2  += dx * dx;
+    }
+
+    int64_t sxy = sum_dxdy - (sum_dx * sum_dy) / n;
+    int64_t sxx = sum_dx2 - (sum_dx * sum_dx) / n;
+    if(sxx <= 0)
+        return;
+
+    // Local microseconds per GPS second, 1000000 for a perfect crystal
+    beacon_drift_ppm_x100 = (int32_t)((sxy * 100) / sxx - 100000000LL);
+
+    uint64_t sum_r2 = 0;
+    for(uint8_t i = 0; i < beacon_sample_count; i++)
+    {
+        const beacon_sample_t &s = beacon_samples[(beacon_sample_head + BEACON_HISTORY_SIZE - beacon_sample_count + i) % BEACON_HISTORY_SIZE];
+        int64_t dx = s.beacon_time - first.beacon_time;
+        int64_t dy = s.local_us - first.local_us;
+        int64_t r  = (dy - sum_dy / n) - ((dx - sum_dx / n) * sxy) / sxx;
+
+        sum_r2 += (uint64_t)(r * r);
+    }
+    beacon_jitter_us = beacon_isqrt(sum_r2 / beacon_sample_count);
+}
+
+static int beacon_gateway_find(const uint8_t *gw_specific)
+{
+    for(uint8_t i = 0; i < beacon_gateway_count; i++)
+    {
+        if(memcmp(beacon_gateways[i].gw_specific, gw_specific, BEACON_GW_SPECIFIC_SIZE) == 0)
+            return i;
+    }
+
+    if(beacon_gateway_count < BEACON_GW_CACHE_SIZE)
+    {
+        beacon_gateway_t &gw = beacon_gateways[beacon_gateway_count];
+
+        memset(&gw, 0, sizeof(gw));
+        memcpy(gw.gw_specific, gw_specific, BEACON_GW_SPECIFIC_SIZE);
+        return beacon_gateway_count++;
+    }
+
+    return -1;
+}
+
+// Local clock for beacon_history_add(), read it as soon as the beacon event is handled
+uint64_t beacon_history_now()
+{
+    return beacon_clock.read_high_resolution_us();
+}
+
+// Record a received beacon, call when the beacon is found or locked
+void beacon_history_add(uint32_t beacon_time, const uint8_t *gw_specific, uint64_t local_us)
+{
+    beacon_sample_t &s = beacon_samples[beacon_sample_head];
+
+    s.beacon_time = beacon_time;
+    s.local_us    = local_us;
+
+    beacon_sample_head = (beacon_sample_head + 1) % BEACON_HISTORY_SIZE;
+    if(beacon_sample_count < BEACON_HISTORY_SIZE)
+        beacon_sample_count++;
+
+    beacon_history_estimate();
+
+    beacon_gateway_current = beacon_gateway_find(gw_specific);
+    if(beacon_gateway_current >= 0)
+    {
+        beacon_gateways[beacon_gateway_current].locks++;
+        beacon_gateways[beacon_gateway_current].last_beacon_time = beacon_time;
+    }
+}
+
+// A missed beacon counts against the gateway the last beacon came from
+void beacon_history_miss()
+{
+    if(beacon_gateway_current >= 0)
+        beacon_gateways[beacon_gateway_current].misses++;
+}
+
+int32_t beacon_history_drift_ppm_x100()
+{
+    return beacon_drift_ppm_x100;
+}
+
+uint32_t beacon_history_jitter_us()
+{
+    return beacon_jitter_us;
+}
+
+// Receive window widening needed elapsed_s after the last beacon: drift over that time plus 3 sigma of jitter
+uint32_t beacon_history_window_us(uint32_t elapsed_s)
+{
+    uint32_t drift = (beacon_drift_ppm_x100 < 0) ? -beacon_drift_ppm_x100 : beacon_drift_ppm_x100;
+
+    return (uint32_t)(((uint64_t)drift * elapsed_s) / 100) + 3 * beacon_jitter_us;
+}
+
+// Print value / 10^decimals without floating point printf support
+static void beacon_print_fixed(int32_t value, uint32_t scale, uint8_t decimals)
+{
+    uint32_t magnitude = (value < 0) ? -(uint32_t)value : (uint32_t)value;
+
+    printf("%s%lu.%0*lu", (value < 0) ? "-" : "", (unsigned long)(magnitude / scale), decimals, (unsigned long)(magnitude % scale));
+}
+
+static void beacon_gateway_print(const beacon_gateway_t &gw)
+{
+    const uint8_t *info = gw.gw_specific + 1;
+    uint32_t total = gw.locks + gw.misses;
+
+    if(gw.gw_specific[0] <= BEACON_INFO_GPS_ANTENNA_MAX)
+    {
+        // 24 bit two's complement, latitude in 90 / 2^23 and longitude in 180 / 2^23 degree units
+        int32_t lat = (int32_t)((uint32_t)(info[0] | (info[1] << 8) | (info[2] << 16)) << 8) >> 8;
+        int32_t lng = (int32_t)((uint32_t)(info[3] | (info[4] << 8) | (info[5] << 16)) << 8) >> 8;
+        int32_t lat_udeg = (int32_t)(((int64_t)lat * 90000000) >> 23);
+        int32_t lng_udeg = (int32_t)(((int64_t)lng * 180000000) >> 23);
+
+        printf("Antenna %u Lat=", gw.gw_specific[0]);
+        beacon_print_fixed(lat_udeg, 1000000, 6);
+        printf(" Lng=");
+        beacon_print_fixed(lng_udeg, 1000000, 6);
+    }
+    else if(gw.gw_specific[0] == BEACON_INFO_NETID_GWID)
+    {
+        printf("NetID=%02X%02X%02X GwID=%02X%02X%02X", info[2], info[1], info[0], info[5], info[4], info[3]);
+    }
+    else
+    {
+        printf("Info %u=%02X%02X%02X%02X%02X%02X", gw.gw_specific[0], info[0], info[1], info[2], info[3], info[4], info[5]);
+    }
+
+    printf(" Locks=%lu Misses=%lu Quality=%lu%% Last=%lu\n", gw.locks, gw.misses,
+        total ? (gw.locks * 100) / total : 0, gw.last_beacon_time);
+}
+
+void beacon_history_print()
+{
+    printf("Beacon Samples        : %u\n", beacon_sample_count);
+    printf("Clock Drift           : ");
+    beacon_print_fixed(beacon_drift_ppm_x100, 100, 2);
+    printf(" ppm\n");
+    printf("Beacon Jitter         : %lu us\n", beacon_jitter_us);
+    printf("Window Widening       : %lu us at 128 s\n", beacon_history_window_us(128));
+    for(uint8_t i = 0; i < beacon_gateway_count; i++)
+    {
+        printf("Gateway %u%c            : ", i, (i == beacon_gateway_current) ? '*' : ' ');
+        beacon_gateway_print(beacon_gateways[i]);
+    }
+}
+
+#endif // _BEACON_HISTORY_HELPER_H
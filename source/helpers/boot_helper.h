@@ -0,0 +1,257 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _BOOT_HELPER_H
+#define _BOOT_HELPER_H
+
+#include "mbed.h"
+#include "mbed_events.h"
+#include "kvstore_global_api.h"
+
+/**
+ * Boot mode detection and reset to first transmission timing.
+ *
+ * - debug: a debugger is attached (Cortex-M3/M4/M7 only, DHCSR is not
+ *   readable by software on M0+).
+ * - warm: software, watchdog or lockup reset, or a reset announced with
+ *   boot_prepare_reset() on targets without reset reason support.
+ * - cold: everything else.
+ *
+ * A boot record is kept in KVStore, like the post-mortem record of
+ * watchdog_helper.h: boot counters, the timing of the last boot of each
+ * mode and the application state cached with boot_save_state(). The state
+ * is cached in RAM and only written by boot_prepare_reset(), so it carries
+ * over the resets the firmware makes itself (the reset command and the
+ * watchdog stall reset). Other warm resets skip the delays with fresh state.
+ *
+ * The record is written once per boot and for each milestone. Writes after
+ * boot_init() go through the save queue, not the thread of the caller.
+ *
+ * RTOS builds measure time with the kernel tick, which starts right after
+ * the clock and RAM setup at reset, so the Mbed OS init before main() is
+ * included. Bare metal builds have no kernel and count from boot_init().
+ */
+
+#define BOOT_KEY            "/kv/boot"
+#define BOOT_MAGIC          0x424f4f55
+#define BOOT_STATE_MAX      16
+
+#define BOOT_MODE_COLD      0
+#define BOOT_MODE_WARM      1
+#define BOOT_MODE_DEBUG     2
+#define BOOT_MODES          3
+
+// Boot milestones
+#define BOOT_MARK_CONNECT   0       // Join request handed to the stack, the first TX
+#define BOOT_MARK_JOINED    1
+#define BOOT_MARK_UPLINK    2       // First uplink done
+#define BOOT_MARK_CLASS_B   3
+#define BOOT_MARKS          4
+
+typedef struct {
+    uint32_t magic;
+    uint32_t boots;
+    uint32_t warm_boots;
+    uint8_t  reset_requested;
+    uint8_t  state_size;
+    uint8_t  state[BOOT_STATE_MAX];
+    uint32_t last_ms[BOOT_MODES][BOOT_MARKS];
+} boot_record_t;
+
+static boot_record_t   boot_record;
+static EventQueue     *boot_save_queue = NULL;
+#if !MBED_CONF_RTOS_PRESENT
+static LowPowerTimer   boot_timer;
+#endif
+static uint8_t         boot_mode = BOOT_MODE_COLD;
+static bool            boot_state_restored = false;
+static uint8_t         boot_state[BOOT_STATE_MAX];
+static uint8_t         boot_state_size = 0;
+static uint32_t        boot_mark_ms[BOOT_MARKS];
+static const char     *boot_mode_names[] = { "cold", "warm", "debug" };
+static const char     *boot_mark_names[] = { "join request", "joined", "first uplink", "class B" };
+
+static uint32_t boot_now_ms()
+{
+#if MBED_CONF_RTOS_PRESENT
+    return (uint32_t)Kernel::get_ms_count();
+#else
+    return boot_timer.read_ms();
+#endif
+}
+
+static void boot_write()
+{
+    int rc = kv_set(BOOT_KEY, &boot_record, sizeof(boot_record), 0);
+
+    if(rc != MBED_SUCCESS)
+        printf("Boot record write failed: %d\n", rc);
+}
+
+static bool boot_debugger_attached()
+{
+#if defined(CoreDebug_DHCSR_C_DEBUGEN_Msk)
+    return (CoreDebug->DHCSR & CoreDebug_DHCSR_C_DEBUGEN_Msk) != 0;
+#else
+    return false;
+#endif
+}
+
+static bool boot_warm_reset()
+{
+#if DEVICE_RESET_REASON
+    switch(ResetReason::get())
+    {
+        case RESET_REASON_SOFTWARE:
+        case RESET_REASON_WATCHDOG:
+        case RESET_REASON_LOCKUP:
+            return true;
+        default:
+            break;
+    }
+#endif
+    return false;
+}
+
+// Call first thing in main(), later record writes are posted to save_queue
+uint8_t boot_init(EventQueue *save_queue)
+{
+    size_t actual_size = 0;
+    bool valid;
+
+#if !MBED_CONF_RTOS_PRESENT
+    boot_timer.start();
+#endif
+    boot_save_queue = save_queue;
+
+    valid = (kv_get(BOOT_KEY, &boot_record, sizeof(boot_record), &actual_size) == MBED_SUCCESS) &&
+            (actual_size == sizeof(boot_record)) && (boot_record.magic == BOOT_MAGIC) &&
+            (boot_record.state_size <= BOOT_STATE_MAX);
+
+    if(boot_debugger_attached())
+        boot_mode = BOOT_MODE_DEBUG;
+    else if(boot_warm_reset() || (valid && boot_record.reset_requested))
+        boot_mode = BOOT_MODE_WARM;
+    else
+        boot_mode = BOOT_MODE_COLD;
+
+    if(!valid)
+    {
+        memset(&boot_record, 0, sizeof(boot_record));
+        boot_record.magic = BOOT_MAGIC;
+    }
+
+    // Cached state was written just before the reset, it only carries over that one
+    boot_state_restored = valid && boot_record.reset_requested && (boot_mode == BOOT_MODE_WARM) &&
+                          (boot_record.state_size > 0);
+    if(boot_state_restored)
+    {
+        memcpy(boot_state, boot_record.state, boot_record.state_size);
+        boot_state_size = boot_record.state_size;
+    }
+    boot_record.state_size = 0;
+
+    boot_record.boots++;
+    if(boot_mode == BOOT_MODE_WARM)
+        boot_record.warm_boots++;
+    boot_record.reset_requested = 0;
+    memset(boot_mark_ms, 0, sizeof(boot_mark_ms));
+    boot_write();
+
+    return boot_mode;
+}
+
+bool boot_is_warm()
+{
+    return boot_mode == BOOT_MODE_WARM;
+}
+
+// Copy the state cached by the previous run, false when there is none
+bool boot_restore_state(void *state, uint8_t size)
+{
+    if(!boot_state_restored || (boot_state_size != size))
+        return false;
+
+    memcpy(state, boot_state, size);
+    return true;
+}
+
+// Cache application state in RAM for boot_prepare_reset()
+void boot_save_state(const void *state, uint8_t size)
+{
+    MBED_ASSERT(size <= BOOT_STATE_MAX);
+
+    core_util_critical_section_enter();
+    memcpy(boot_state, state, size);
+    boot_state_size = size;
+    core_util_critical_section_exit();
+}
+
+// Call right before a software reset, writes the record with the cached state
+void boot_prepare_reset()
+{
+    boot_record.reset_requested = 1;
+    memcpy(boot_record.state, boot_state, boot_state_size);
+    boot_record.state_size = boot_state_size;
+    boot_write();
+}
+
+// Record the first time a milestone is reached
+void boot_mark(uint8_t mark)
+{
+    if((mark >= BOOT_MARKS) || boot_mark_ms[mark])
+        return;
+
+    boot_mark_ms[mark] = boot_now_ms();
+    if(boot_mark_ms[mark] == 0)
+        boot_mark_ms[mark] = 1;
+
+    printf("Boot %s: %s after %lu ms\n", boot_mode_names[boot_mode], boot_mark_names[mark], boot_mark_ms[mark]);
+
+    boot_record.last_ms[boot_mode][mark] = boot_mark_ms[mark];
+    if(boot_save_queue)
+        boot_save_queue->call(boot_write);
+}
+
+// Time of a milestone in this boot, 0 when not reached yet
+uint32_t boot_mark_get(uint8_t mark)
+{
+    return (mark < BOOT_MARKS) ? boot_mark_ms[mark] : 0;
+}
+
+const char *boot_mode_name()
+{
+    return boot_mode_names[boot_mode];
+}
+
+void boot_print_stats()
+{
+    printf("Boot Mode             : %s, boot %lu (%lu warm), state %s\n", boot_mode_names[boot_mode],
+        boot_record.boots, boot_record.warm_boots, boot_state_restored ? "restored" : "not restored");
+    for(uint8_t mode = 0; mode < BOOT_MODES; mode++)
+    {
+        char label[24];
+
+        snprintf(label, sizeof(label), "Last %s Boot", boot_mode_names[mode]);
+        printf("%-22s:", label);
+        for(uint8_t mark = 0; mark < BOOT_MARKS; mark++)
+            printf(" %s=%lu ms", boot_mark_names[mark], boot_record.last_ms[mode][mark]);
+        printf("\n");
+    }
+}
+
+#endif // _BOOT_HELPER_H
@@ -0,0 +1,187 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _CONFIG_SNAPSHOT_HELPER_H
+#define _CONFIG_SNAPSHOT_HELPER_H
+
+#include "mbed.h"
+#include "kvstore_global_api.h"
+
+/**
+ * Binary configuration snapshot.
+ *
+ * One blob holds the firmware version, the runtime settings, which
+ * credentials are provisioned and the application counters. Multi-byte
+ * fields are big endian, the blob ends with a CRC-16/CCITT of the bytes
+ * before it:
+ *
+ *   0     tag and format, CONFIG_SNAPSHOT_TAG
+ *   1-3   firmware major, minor, patch
+ *   4-5   uplink interval in seconds          (settings, applied on import)
+ *   6     confirmed uplinks 0/1
+ *   7     ADR 0/1
+ *   8     device class A=0, B=1, C=2
+ *   9     ping slot periodicity
+ *   10    trace level
+ *   11-12 trace group mask
+ *   13    credentials, CONFIG_CREDENTIAL_* bits (status, ignored on import)
+ *   14-15 received messages
+ *   16-17 beacon locks
+ *   18-19 beacon misses
+ *   20-21 CRC
+ *
+ * The tag also tells the blob apart from the other reports sharing the
+ * diagnostic FPort.
+ *
+ * An import is written to KVStore as one record (a journal) before the
+ * settings are written key by key, and removed after. A journal found at
+ * boot means the import was cut short, it is then applied again.
+ */
+
+#define CONFIG_SNAPSHOT_TAG         0xc1
+#define CONFIG_SNAPSHOT_SIZE        22
+#define CONFIG_SNAPSHOT_KEY         "/kv/configsnap"
+
+// Provisioned credentials
+#define CONFIG_CREDENTIAL_DEV_EUI   0x01    // DevEUI from the configuration, not the built-in one
+#define CONFIG_CREDENTIAL_APP_EUI   0x02
+#define CONFIG_CREDENTIAL_APP_KEY   0x04
+
+typedef struct {
+    uint8_t  version[3];
+    uint16_t tx_interval;
+    uint8_t  confirmed;
+    uint8_t  adr_on;
+    uint8_t  device_class;
+    uint8_t  ping_slot_periodicity;
+    uint8_t  trace_level;
+    uint16_t trace_groups;
+    uint8_t  credentials;
+    uint16_t rx;
+    uint16_t beacon_lock;
+    uint16_t beacon_miss;
+} config_snapshot_t;
+
+static uint16_t config_snapshot_crc(const uint8_t *buffer, uint8_t size)
+{
+    MbedCRC<POLY_16BIT_CCITT, 16> ct;
+    uint32_t crc = 0;
+
+    ct.compute(buffer, size, &crc);
+    return crc;
+}
+
+static uint8_t *config_snapshot_put16(uint8_t *p, uint16_t value)
+{
+    *p++ = value >> 8;
+    *p++ = value & 0xff;
+    return p;
+}
+
+static uint16_t config_snapshot_get16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+// Returns the blob size, buffer holds at least CONFIG_SNAPSHOT_SIZE bytes
+uint8_t config_snapshot_pack(const config_snapshot_t &snapshot, uint8_t *buffer)
+{
+    uint8_t *p = buffer;
+
+    *p++ = CONFIG_SNAPSHOT_TAG;
+    memcpy(p, snapshot.version, sizeof(snapshot.version));
+    p += sizeof(snapshot.version);
+    p = config_snapshot_put16(p, snapshot.tx_interval);
+    *p++ = snapshot.confirmed;
+    *p++ = snapshot.adr_on;
+    *p++ = snapshot.device_class;
+    *p++ = snapshot.ping_slot_periodicity;
+    *p++ = snapshot.trace_level;
+    p = config_snapshot_put16(p, snapshot.trace_groups);
+    *p++ = snapshot.credentials;
+    p = config_snapshot_put16(p, snapshot.rx);
+    p = config_snapshot_put16(p, snapshot.beacon_lock);
+    p = config_snapshot_put16(p, snapshot.beacon_miss);
+    p = config_snapshot_put16(p, config_snapshot_crc(buffer, p - buffer));
+
+    return p - buffer;
+}
+
+// False when the size, tag or CRC is wrong, the values are not range checked
+bool config_snapshot_unpack(const uint8_t *buffer, uint8_t size, config_snapshot_t &snapshot)
+{
+    const uint8_t *p = buffer + 1;
+
+    if((size != CONFIG_SNAPSHOT_SIZE) || (buffer[0] != CONFIG_SNAPSHOT_TAG) ||
+       (config_snapshot_crc(buffer, size - 2) != config_snapshot_get16(buffer + size - 2)))
+        return false;
+
+    memcpy(snapshot.version, p, sizeof(snapshot.version));
+    p += sizeof(snapshot.version);
+    snapshot.tx_interval           = config_snapshot_get16(p);
+    p += 2;
+    snapshot.confirmed             = *p++;
+    snapshot.adr_on                = *p++;
+    snapshot.device_class          = *p++;
+    snapshot.ping_slot_periodicity = *p++;
+    snapshot.trace_level           = *p++;
+    snapshot.trace_groups          = config_snapshot_get16(p);
+    p += 2;
+    snapshot.credentials           = *p++;
+    snapshot.rx                    = config_snapshot_get16(p);
+    snapshot.beacon_lock           = config_snapshot_get16(p + 2);
+    snapshot.beacon_miss           = config_snapshot_get16(p + 4);
+
+    return true;
+}
+
+void config_snapshot_print(const uint8_t *buffer, uint8_t size)
+{
+    for(uint8_t i = 0; i < size; i++)
+        printf("%02x", buffer[i]);
+}
+
+int config_snapshot_journal_save(const uint8_t *buffer)
+{
+    return kv_set(CONFIG_SNAPSHOT_KEY, buffer, CONFIG_SNAPSHOT_SIZE, 0);
+}
+
+// An import cut short, false when there is none
+bool config_snapshot_journal_load(config_snapshot_t &snapshot)
+{
+    uint8_t buffer[CONFIG_SNAPSHOT_SIZE];
+    size_t actual_size = 0;
+
+    if(kv_get(CONFIG_SNAPSHOT_KEY, buffer, sizeof(buffer), &actual_size) != MBED_SUCCESS)
+        return false;
+
+    if(!config_snapshot_unpack(buffer, actual_size, snapshot))
+    {
+        printf("Config snapshot journal invalid, removed\n");
+        kv_remove(CONFIG_SNAPSHOT_KEY);
+        return false;
+    }
+
+    return true;
+}
+
+int config_snapshot_journal_clear()
+{
+    return kv_remove(CONFIG_SNAPSHOT_KEY);
+}
+
+#endif // _CONFIG_SNAPSHOT_HELPER_H
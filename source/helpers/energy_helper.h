@@ -0,0 +1,473 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ENERGY_HELPER_H
+#define _ENERGY_HELPER_H
+
+#include "mbed.h"
+#include "lorawan/LoRaRadio.h"
+#include "power_helper.h"
+
+/**
+ * Energy model from time in state and per-board currents.
+ *
+ * RadioEnergy wraps the radio driver and times each radio state from the
+ * driver calls and events:
+ * - TX, from send() to TX done, per spreading factor, bandwidth and power
+ *   (the data rate and power the MAC selected).
+ * - RX windows, receptions starting within ENERGY_RX_WINDOW_MS of a TX.
+ * - Beacons, receptions configured with a fixed length (implicit header).
+ * - Ping slots, all other receptions, Class C continuous reception included.
+ * The radio sleeps otherwise. MCU run, sleep and deep sleep times come from
+ * the Mbed CPU statistics, see power_helper.h.
+ *
+ * Currents are board specific and set in mbed_app.json, the TX current is a
+ * table of {dBm, uA} pairs in increasing power order, a TX uses the first
+ * entry at or above its power. Defaults are datasheet typicals, measure the
+ * board to refine them.
+ *
+ * The diagnostic uplink shares its FPort with the watchdog report, which
+ * starts with its reason (0-3). This one starts with ENERGY_REPORT_TAG.
+ */
+
+#define ENERGY_RX_WINDOW_MS         7000    // Join accept RX2 opens 6 s after the TX
+#define ENERGY_TX_BINS              8
+#define ENERGY_REPORT_TAG           0xe0
+#define ENERGY_REPORT_SIZE          7
+#define ENERGY_REPORT_INTERVAL      MBED_CONF_APP_ENERGY_REPORT_INTERVAL
+
+// Radio states
+#define ENERGY_STATE_IDLE           0
+#define ENERGY_STATE_TX             1
+#define ENERGY_STATE_RX_WINDOW      2
+#define ENERGY_STATE_RX_BEACON      3
+#define ENERGY_STATE_RX_PING        4
+#define ENERGY_RX_KINDS             3
+
+typedef struct {
+    int8_t   dbm;
+    uint32_t ua;
+} energy_tx_current_t;
+
+typedef struct {
+    uint8_t  sf;
+    uint8_t  bandwidth;
+    int8_t   power;
+    uint32_t count;
+    uint64_t time_us;
+} energy_tx_bin_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t time_us;
+} energy_rx_bin_t;
+
+// Charge in uA x ms
+typedef struct {
+    uint64_t tx;
+    uint64_t rx;
+    uint64_t radio_idle;
+    uint64_t mcu;
+    uint64_t elapsed_ms;
+} energy_charge_t;
+
+static const energy_tx_current_t energy_tx_current[] = MBED_CONF_APP_ENERGY_TX_CURRENT;
+static const char *energy_rx_names[ENERGY_RX_KINDS] = { "RX windows", "Beacons", "Ping slots" };
+
+static LowPowerTimer   energy_timer;
+static uint8_t         energy_state = ENERGY_STATE_IDLE;
+static uint64_t        energy_state_start_us = 0;
+static uint64_t        energy_tx_end_us = 0;
+static bool            energy_tx_seen = false;
+static int8_t          energy_tx_index = -1;
+static uint8_t         energy_tx_count = 0;
+static energy_tx_bin_t energy_tx[ENERGY_TX_BINS];
+static energy_rx_bin_t energy_rx[ENERGY_RX_KINDS];
+static energy_charge_t energy_cycle_start;
+static energy_charge_t energy_last_cycle;
+static uint32_t        energy_cycle_count = 0;
+static uint64_t        energy_report_ms = 0;
+
+static uint64_t energy_now_us()
+{
+    return energy_timer.read_high_resolution_us();
+}
+
+// Close the current radio state
+static void energy_radio_idle()
+{
+    uint64_t now = energy_now_us();
+    uint64_t elapsed = now - energy_state_start_us;
+
+    if(energy_state == ENERGY_STATE_TX)
+    {
+        if(energy_tx_index >= 0)
+            energy_tx[energy_tx_index].time_us += elapsed;
+        energy_tx_end_us = now;
+        energy_tx_seen   = true;
+    }
+    else if(energy_state != ENERGY_STATE_IDLE)
+    {
+        energy_rx[energy_state - ENERGY_STATE_RX_WINDOW].time_us += elapsed;
+    }
+
+    energy_state = ENERGY_STATE_IDLE;
+}
+
+static void energy_radio_tx(uint8_t sf, uint8_t bandwidth, int8_t power)
+{
+    uint8_t i;
+
+    energy_radio_idle();
+
+    for(i = 0; i < energy_tx_count; i++)
+    {
+        if((energy_tx[i].sf == sf) && (energy_tx[i].bandwidth == bandwidth) && (energy_tx[i].power == power))
+            break;
+    }
+
+    // The last bin takes everything once the table is full
+    if(i == ENERGY_TX_BINS)
+        i = ENERGY_TX_BINS - 1;
+    else if(i == energy_tx_count)
+    {
+        energy_tx[i].sf        = sf;
+        energy_tx[i].bandwidth = bandwidth;
+        energy_tx[i].power     = power;
+        energy_tx_count++;
+    }
+
+    energy_tx[i].count++;
+    energy_tx_index       = i;
+    energy_state          = ENERGY_STATE_TX;
+    energy_state_start_us = energy_now_us();
+}
+
+static void energy_radio_rx(bool beacon)
+{
+    uint64_t now;
+
+    energy_radio_idle();
+    now = energy_now_us();
+
+    if(beacon)
+        energy_state = ENERGY_STATE_RX_BEACON;
+    else if(energy_tx_seen && (now - energy_tx_end_us < ENERGY_RX_WINDOW_MS * 1000ULL))
+        energy_state = ENERGY_STATE_RX_WINDOW;
+    else
+        energy_state = ENERGY_STATE_RX_PING;
+
+    energy_rx[energy_state - ENERGY_STATE_RX_WINDOW].count++;
+    energy_state_start_us = now;
+}
+
+static uint32_t energy_tx_current_ua(int8_t power)
+{
+    const uint8_t entries = sizeof(energy_tx_current) / sizeof(energy_tx_current[0]);
+
+    for(uint8_t i = 0; i < entries; i++)
+    {
+        if(energy_tx_current[i].dbm >= power)
+            return energy_tx_current[i].ua;
+    }
+
+    return energy_tx_current[entries - 1].ua;
+}
+
+template<typename Radio>
+class RadioEnergy : public Radio {
+public:
+    template<typename... Args>
+    RadioEnergy(Args... args) : Radio(args...), _app_events(NULL), _tx_sf(0), _tx_bandwidth(0), _tx_power(0),
+                                _rx_fix_len(false), _rx_continuous(false)
+    {
+        energy_timer.start();
+    }
+
+    virtual void init_radio(radio_events_t *events)
+    {
+        // Events ending a radio state are intercepted, the others are forwarded as is
+        _app_events        = events;
+        _events            = *events;
+        _events.tx_done    = mbed::callback(this, &RadioEnergy::tx_done);
+        _events.tx_timeout = mbed::callback(this, &RadioEnergy::tx_timeout);
+        _events.rx_done    = mbed::callback(this, &RadioEnergy::rx_done);
+        _events.rx_timeout = mbed::callback(this, &RadioEnergy::rx_timeout);
+        _events.rx_error   = mbed::callback(this, &RadioEnergy::rx_error);
+
+        Radio::init_radio(&_events);
+    }
+
+    virtual void radio_reset()
+    {
+        energy_radio_idle();
+        Radio::radio_reset();
+    }
+
+    virtual void sleep(void)
+    {
+        energy_radio_idle();
+        Radio::sleep();
+    }
+
+    virtual void standby(void)
+    {
+        energy_radio_idle();
+        Radio::standby();
+    }
+
+    virtual void set_rx_config(radio_modems_t modem, uint32_t bandwidth, uint32_t datarate, uint8_t coderate,
+                               uint32_t bandwidth_afc, uint16_t preamble_len, uint16_t symb_timeout, bool fix_len,
+                               uint8_t payload_len, bool crc_on, bool freq_hop_on, uint8_t hop_period,
+                               bool iq_inverted, bool rx_continuous)
+    {
+        _rx_fix_len    = fix_len;
+        _rx_continuous = rx_continuous;
+
+        Radio::set_rx_config(modem, bandwidth, datarate, coderate, bandwidth_afc, preamble_len, symb_timeout,
+                             fix_len, payload_len, crc_on, freq_hop_on, hop_period, iq_inverted, rx_continuous);
+    }
+
+    virtual void set_tx_config(radio_modems_t modem, int8_t power, uint32_t fdev, uint32_t bandwidth,
+                               uint32_t datarate, uint8_t coderate, uint16_t preamble_len, bool fix_len,
+                               bool crc_on, bool freq_hop_on, uint8_t hop_period, bool iq_inverted, uint32_t timeout)
+    {
+        _tx_sf        = datarate;
+        _tx_bandwidth = bandwidth;
+        _tx_power     = power;
+
+        Radio::set_tx_config(modem, power, fdev, bandwidth, datarate, coderate, preamble_len, fix_len,
+                             crc_on, freq_hop_on, hop_period, iq_inverted, timeout);
+    }
+
+    virtual void send(uint8_t *buffer, uint8_t size)
+    {
+        energy_radio_tx(_tx_sf, _tx_bandwidth, _tx_power);
+        Radio::send(buffer, size);
+    }
+
+    virtual void receive(void)
+    {
+        energy_radio_rx(_rx_fix_len);
+        Radio::receive();
+    }
+
+private:
+    void tx_done()
+    {
+        energy_radio_idle();
+        if(_app_events && _app_events->tx_done)
+            _app_events->tx_done();
+    }
+
+    void tx_timeout()
+    {
+        energy_radio_idle();
+        if(_app_events && _app_events->tx_timeout)
+            _app_events->tx_timeout();
+    }
+
+    void rx_done(const uint8_t *payload, uint16_t size, int16_t rssi, int8_t snr)
+    {
+        // Continuous reception goes on after a frame
+        if(!_rx_continuous)
+            energy_radio_idle();
+        if(_app_events && _app_events->rx_done)
+            _app_events->rx_done(payload, size, rssi, snr);
+    }
+
+    void rx_timeout()
+    {
+        energy_radio_idle();
+        if(_app_events && _app_events->rx_timeout)
+            _app_events->rx_timeout();
+    }
+
+    void rx_error()
+    {
+        if(!_rx_continuous)
+            energy_radio_idle();
+        if(_app_events && _app_events->rx_error)
+            _app_events->rx_error();
+    }
+
+    radio_events_t *_app_events;
+    radio_events_t  _events;
+    uint8_t         _tx_sf;
+    uint8_t         _tx_bandwidth;
+    int8_t          _tx_power;
+    bool            _rx_fix_len;
+    bool            _rx_continuous;
+};
+
+// Charge used since boot, the state in progress included
+void energy_get_charge(energy_charge_t &charge)
+{
+    uint64_t now = energy_now_us();
+    uint64_t tx_us = 0, rx_us = 0;
+    power_times_t times;
+
+    memset(&charge, 0, sizeof(charge));
+
+    for(uint8_t i = 0; i < energy_tx_count; i++)
+    {
+        uint64_t time_us = energy_tx[i].time_us;
+
+        if((energy_state == ENERGY_STATE_TX) && (energy_tx_index == i))
+            time_us += now - energy_state_start_us;
+        charge.tx += time_us * energy_tx_current_ua(energy_tx[i].power) / 1000;
+        tx_us     += time_us;
+    }
+
+    for(uint8_t i = 0; i < ENERGY_RX_KINDS; i++)
+        rx_us += energy_rx[i].time_us;
+    if(energy_state >= ENERGY_STATE_RX_WINDOW)
+        rx_us += now - energy_state_start_us;
+    charge.rx = rx_us * MBED_CONF_APP_ENERGY_RADIO_RX_CURRENT / 1000;
+
+    charge.radio_idle = ((now > tx_us + rx_us) ? now - tx_us - rx_us : 0) * MBED_CONF_APP_ENERGY_RADIO_SLEEP_CURRENT / 1000;
+
+    power_get_times(times);
+    charge.mcu = (times.active_us * MBED_CONF_APP_ENERGY_MCU_RUN_CURRENT +
+                  times.sleep_us * MBED_CONF_APP_ENERGY_MCU_SLEEP_CURRENT +
+                  times.deep_sleep_us * MBED_CONF_APP_ENERGY_MCU_DEEP_SLEEP_CURRENT) / 1000;
+
+    charge.elapsed_ms = now / 1000;
+}
+
+static uint64_t energy_total(const energy_charge_t &charge)
+{
+    return charge.tx + charge.rx + charge.radio_idle + charge.mcu;
+}
+
+// mAh per day x 100 at the average current of charge uA x ms over elapsed_ms
+static uint32_t energy_mah_per_day_x100(uint64_t charge, uint64_t elapsed_ms)
+{
+    return elapsed_ms ? (uint32_t)(charge * 24 / 10 / elapsed_ms) : 0;
+}
+
+static uint8_t energy_percent(uint64_t part, uint64_t total)
+{
+    return total ? (uint8_t)(part * 100 / total) : 0;
+}
+
+// Call once per uplink cycle, keeps the charge used by the cycle for energy_print_stats()
+void energy_cycle_mark()
+{
+    energy_charge_t now;
+
+    energy_get_charge(now);
+    energy_cycle_count++;
+
+    energy_last_cycle.tx         = now.tx - energy_cycle_start.tx;
+    energy_last_cycle.rx         = now.rx - energy_cycle_start.rx;
+    energy_last_cycle.radio_idle = now.radio_idle - energy_cycle_start.radio_idle;
+    energy_last_cycle.mcu        = now.mcu - energy_cycle_start.mcu;
+    energy_last_cycle.elapsed_ms = now.elapsed_ms - energy_cycle_start.elapsed_ms;
+
+    energy_cycle_start = now;
+}
+
+static void energy_print_mah(const char *label, uint64_t charge, uint64_t total, uint64_t elapsed_ms)
+{
+    uint32_t mah = energy_mah_per_day_x100(charge, elapsed_ms);
+
+    printf("%-22s: %lu.%02lu mAh/day (%u%%)\n", label, mah / 100, mah % 100, energy_percent(charge, total));
+}
+
+void energy_print_stats()
+{
+    energy_charge_t charge;
+    uint64_t total;
+
+    energy_get_charge(charge);
+    total = energy_total(charge);
+
+    energy_print_mah("Energy Estimate", total, total, charge.elapsed_ms);
+    energy_print_mah("Radio TX", charge.tx, total, charge.elapsed_ms);
+    energy_print_mah("Radio RX", charge.rx, total, charge.elapsed_ms);
+    energy_print_mah("Radio Sleep", charge.radio_idle, total, charge.elapsed_ms);
+    energy_print_mah("MCU", charge.mcu, total, charge.elapsed_ms);
+#if !MBED_CPU_STATS_ENABLED
+    printf("MCU time unknown, CPU statistics disabled (platform.cpu-stats-enabled)\n");
+#endif
+    printf("Energy Last Cycle     : cycle %lu, %lu ms, tx=%lu rx=%lu radio sleep=%lu mcu=%lu uAs\n", energy_cycle_count,
+        (uint32_t)energy_last_cycle.elapsed_ms,
+        (uint32_t)(energy_last_cycle.tx / 1000),
+        (uint32_t)(energy_last_cycle.rx / 1000),
+        (uint32_t)(energy_last_cycle.radio_idle / 1000),
+        (uint32_t)(energy_last_cycle.mcu / 1000));
+
+    printf("%-22s %8s %10s %8s\n", "Radio State", "count", "time ms", "uA");
+    for(uint8_t i = 0; i < energy_tx_count; i++)
+    {
+        char label[24];
+
+        // LoRa bandwidth codes 0-2 are 125, 250 and 500 kHz
+        snprintf(label, sizeof(label), "TX SF%u/%u %d dBm", energy_tx[i].sf,
+            (energy_tx[i].bandwidth <= 2) ? 125 << energy_tx[i].bandwidth : energy_tx[i].bandwidth, energy_tx[i].power);
+        printf("%-22s %8lu %10lu %8lu\n", label, energy_tx[i].count, (uint32_t)(energy_tx[i].time_us / 1000),
+            energy_tx_current_ua(energy_tx[i].power));
+    }
+    for(uint8_t i = 0; i < ENERGY_RX_KINDS; i++)
+    {
+        printf("%-22s %8lu %10lu %8lu\n", energy_rx_names[i], energy_rx[i].count,
+            (uint32_t)(energy_rx[i].time_us / 1000), (uint32_t)MBED_CONF_APP_ENERGY_RADIO_RX_CURRENT);
+    }
+}
+
+// A diagnostic uplink is due every ENERGY_REPORT_INTERVAL seconds
+bool energy_report_due()
+{
+    return (ENERGY_REPORT_INTERVAL != 0) &&
+           (energy_now_us() / 1000 - energy_report_ms >= ENERGY_REPORT_INTERVAL * 1000ULL);
+}
+
+// Report: tag, mAh per day x 100 (2 bytes, big endian), percent of the charge
+// used by radio TX, radio RX and the MCU, days since boot. Values saturate.
+uint8_t energy_report(uint8_t *buffer, uint8_t max_size)
+{
+    energy_charge_t charge;
+    uint64_t total;
+    uint32_t mah, days;
+
+    if(max_size < ENERGY_REPORT_SIZE)
+        return 0;
+
+    energy_get_charge(charge);
+    total = energy_total(charge);
+    mah   = energy_mah_per_day_x100(total, charge.elapsed_ms);
+    days  = charge.elapsed_ms / 86400000;
+
+    buffer[0] = ENERGY_REPORT_TAG;
+    buffer[1] = (mah > 0xffff) ? 0xff : (mah >> 8);
+    buffer[2] = (mah > 0xffff) ? 0xff : (mah & 0xff);
+    buffer[3] = energy_percent(charge.tx, total);
+    buffer[4] = energy_percent(charge.rx, total);
+    buffer[5] = energy_percent(charge.mcu, total);
+    buffer[6] = (days > 0xff) ? 0xff : days;
+
+    return ENERGY_REPORT_SIZE;
+}
+
+// The report went out
+void energy_report_sent()
+{
+    energy_report_ms = energy_now_us() / 1000;
+}
+
+#endif // _ENERGY_HELPER_H
@@ -0,0 +1,197 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _EVENT_TRACE_HELPER_H
+#define _EVENT_TRACE_HELPER_H
+
+#include "mbed.h"
+#include "lorawan_types.h"
+#include "kvstore_global_api.h"
+
+/**
+ * Compact binary trace of stack events, application callbacks and commands.
+ *
+ * Records are 8 bytes and kept in a RAM ring, the oldest records are
+ * overwritten. The ring can be saved to KVStore to survive a reset. Each
+ * record carries the application state flags at the time it was taken so
+ * tools/trace_replay.py can replay a dump against a model of the application
+ * and report where the device diverged.
+ *
+ * Event codes are application defined and independent of the lorawan_event_t
+ * numbering of the stack.
+ */
+
+#define EVENT_TRACE_RECORDS             MBED_CONF_APP_EVENT_TRACE_RECORDS
+#define EVENT_TRACE_VERSION             1
+#define EVENT_TRACE_KEY                 "/kv/evtrace"
+
+// Record types
+#define TRACE_TYPE_EVENT                1
+#define TRACE_TYPE_CALLBACK             2
+#define TRACE_TYPE_SERIAL_COMMAND       3
+#define TRACE_TYPE_DOWNLINK_COMMAND     4
+#define TRACE_TYPE_BOOT                 5
+
+// Event codes
+#define TRACE_EV_CONNECTED              1
+#define TRACE_EV_DISCONNECTED           2
+#define TRACE_EV_TX_DONE                3
+#define TRACE_EV_TX_ERROR               4
+#define TRACE_EV_RX_DONE                5
+#define TRACE_EV_RX_ERROR               6
+#define TRACE_EV_JOIN_FAILURE           7
+#define TRACE_EV_DEVICE_TIME_SYNCHED    8
+#define TRACE_EV_PING_SLOT_INFO_SYNCHED 9
+#define TRACE_EV_BEACON_NOT_FOUND       10
+#define TRACE_EV_BEACON_FOUND           11
+#define TRACE_EV_BEACON_LOCK            12
+#define TRACE_EV_BEACON_MISS            13
+#define TRACE_EV_SWITCH_CLASS_B_TO_A    14
+#define TRACE_EV_OTHER                  15
+
+// Callback codes
+#define TRACE_CB_LINK_CHECK             1
+
+// State flags, bits 0-1 hold the configured device class
+#define TRACE_FLAG_CLASS_B_ON           0x04
+#define TRACE_FLAG_BEACON_ACQ           0x08
+#define TRACE_FLAG_PING_SLOT_SYNCHED    0x10
+#define TRACE_FLAG_TIME_SYNCHED         0x20
+#define TRACE_FLAG_BEACON_FOUND         0x40
+
+typedef struct {
+    uint32_t time_ms;
+    uint8_t  type;
+    uint8_t  code;
+    uint8_t  arg;
+    uint8_t  flags;
+} event_trace_record_t;
+
+static event_trace_record_t event_trace[EVENT_TRACE_RECORDS];
+static uint16_t             event_trace_head    = 0;
+static uint16_t             event_trace_count   = 0;
+static uint32_t             event_trace_dropped = 0;
+static LowPowerTimer        event_trace_timer;
+
+// Oldest first copy of the ring, used to save and print traces
+static event_trace_record_t event_trace_copy[EVENT_TRACE_RECORDS];
+
+void event_trace_init()
+{
+    event_trace_timer.start();
+}
+
+uint8_t event_trace_code(lorawan_event_t event)
+{
+    switch(event)
+    {
+        case CONNECTED:              return TRACE_EV_CONNECTED;
+        case DISCONNECTED:           return TRACE_EV_DISCONNECTED;
+        case TX_DONE:                return TRACE_EV_TX_DONE;
+        case TX_TIMEOUT:
+        case TX_ERROR:
+        case TX_CRYPTO_ERROR:
+        case TX_SCHEDULING_ERROR:    return TRACE_EV_TX_ERROR;
+        case RX_DONE:                return TRACE_EV_RX_DONE;
+        case RX_TIMEOUT:
+        case RX_ERROR:               return TRACE_EV_RX_ERROR;
+        case JOIN_FAILURE:           return TRACE_EV_JOIN_FAILURE;
+        case DEVICE_TIME_SYNCHED:    return TRACE_EV_DEVICE_TIME_SYNCHED;
+        case PING_SLOT_INFO_SYNCHED: return TRACE_EV_PING_SLOT_INFO_SYNCHED;
+        case BEACON_NOT_FOUND:       return TRACE_EV_BEACON_NOT_FOUND;
+        case BEACON_FOUND:           return TRACE_EV_BEACON_FOUND;
+        case BEACON_LOCK:            return TRACE_EV_BEACON_LOCK;
+        case BEACON_MISS:            return TRACE_EV_BEACON_MISS;
+        case SWITCH_CLASS_B_TO_A:    return TRACE_EV_SWITCH_CLASS_B_TO_A;
+        default:                     return TRACE_EV_OTHER;
+    }
+}
+
+void event_trace_record(uint8_t type, uint8_t code, uint8_t arg, uint8_t flags)
+{
+    event_trace_record_t &record = event_trace[event_trace_head];
+
+    record.time_ms = event_trace_timer.read_ms();
+    record.type    = type;
+    record.code    = code;
+    record.arg     = arg;
+    record.flags   = flags;
+
+    event_trace_head = (event_trace_head + 1) % EVENT_TRACE_RECORDS;
+    if(event_trace_count < EVENT_TRACE_RECORDS)
+        event_trace_count++;
+    else
+        event_trace_dropped++;
+}
+
+// Copy the most recent records, oldest first, returns the number copied
+uint16_t event_trace_last(event_trace_record_t *records, uint16_t max_records)
+{
+    uint16_t count = (event_trace_count < max_records) ? event_trace_count : max_records;
+    uint16_t index = (event_trace_head + EVENT_TRACE_RECORDS - count) % EVENT_TRACE_RECORDS;
+
+    for(uint16_t i = 0; i < count; i++)
+    {
+        records[i] = event_trace[index];
+        index = (index + 1) % EVENT_TRACE_RECORDS;
+    }
+
+    return count;
+}
+
+static void event_trace_print(const event_trace_record_t *records, uint16_t count, uint32_t dropped)
+{
+    printf("TRACE-BEGIN %u %u %lu\n", EVENT_TRACE_VERSION, count, dropped);
+    for(uint16_t i = 0; i < count; i++)
+    {
+        printf("TRACE %08lx%02x%02x%02x%02x\n",
+            records[i].time_ms, records[i].type, records[i].code, records[i].arg, records[i].flags);
+    }
+    printf("TRACE-END\n");
+}
+
+// Dump format read by tools/trace_replay.py: a header line then one line of hex per record
+void event_trace_dump()
+{
+    uint16_t count = event_trace_last(event_trace_copy, EVENT_TRACE_RECORDS);
+
+    event_trace_print(event_trace_copy, count, event_trace_dropped);
+}
+
+// Save the ring to KVStore, oldest record first
+int event_trace_save()
+{
+    uint16_t count = event_trace_last(event_trace_copy, EVENT_TRACE_RECORDS);
+
+    return kv_set(EVENT_TRACE_KEY, event_trace_copy, count * sizeof(event_trace_record_t), 0);
+}
+
+void event_trace_dump_saved()
+{
+    size_t actual_size = 0;
+
+    int rc = kv_get(EVENT_TRACE_KEY, event_trace_copy, sizeof(event_trace_copy), &actual_size);
+    if(rc != MBED_SUCCESS)
+    {
+        printf("No saved trace, rc=%d\n", MBED_GET_ERROR_CODE(rc));
+        return;
+    }
+
+    event_trace_print(event_trace_copy, actual_size / sizeof(event_trace_record_t), 0);
+}
+
+#endif // _EVENT_TRACE_HELPER_H
@@ -0,0 +1,704 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAG_SESSION_HELPER_H
+#define _FRAG_SESSION_HELPER_H
+
+#include "mbed.h"
+#include "BlockDevice.h"
+
+/**
+ * LoRaWAN fragmented data block transport (FUOTA fragmentation session) with
+ * forward error correction.
+ *
+ * Uncoded fragments are written to the block device at their final location.
+ * Once coded fragments arrive the list of missing fragments is frozen and each
+ * coded fragment is reduced into an upper triangular parity matrix with one
+ * bit per missing fragment, so RAM is bounded by the redundancy and not by the
+ * image size. The reduced data of each matrix row is kept on the block device
+ * after the image. When the matrix has full rank the missing fragments are
+ * recovered by back substitution.
+ *
+ * All block device writes go through a single page cache so the device only
+ * sees page aligned reads and programs.
+ *
+ * The session only takes DataFragments sent by unicast or, when the setup bound
+ * it to at least one multicast group, by multicast. The stack reports that a
+ * downlink was multicast but not for which group, so a session bound to any
+ * group accepts fragments from every group.
+ *
+ * A session setup erases the image and scratch area and coded fragments read
+ * stored fragments back, so frag_session_process() can block for seconds. Call
+ * it from a thread that tolerates that, not from the radio event queue.
+ */
+
+#define FRAG_PORT                   MBED_CONF_APP_FUOTA_PORT
+#define FRAG_MAX_NB                 MBED_CONF_APP_FUOTA_MAX_FRAGMENTS
+#define FRAG_MAX_SIZE               MBED_CONF_APP_FUOTA_MAX_FRAGMENT_SIZE
+#define FRAG_MAX_REDUNDANCY         MBED_CONF_APP_FUOTA_MAX_REDUNDANCY
+#define FRAG_PAGE_SIZE              MBED_CONF_APP_FUOTA_PAGE_SIZE
+
+// Fragmentation package commands
+#define FRAG_PACKAGE_VERSION_REQ    0x00
+#define FRAG_SESSION_STATUS_REQ     0x01
+#define FRAG_SESSION_SETUP_REQ      0x02
+#define FRAG_SESSION_DELETE_REQ     0x03
+#define FRAG_DATA_FRAGMENT          0x08
+
+#define FRAG_PACKAGE_IDENTIFIER     3
+#define FRAG_PACKAGE_VERSION        1
+
+// FragSessionSetupAns status bits
+#define FRAG_SETUP_ENCODING_UNSUPPORTED 0x01
+#define FRAG_SETUP_NOT_ENOUGH_MEMORY    0x02
+#define FRAG_SETUP_INDEX_UNSUPPORTED    0x04
+
+// FragSessionDeleteAns status bits
+#define FRAG_DELETE_NO_SESSION          0x04
+
+// FragSessionStatusAns status bits
+#define FRAG_STATUS_MATRIX_OVERFLOW     0x01
+
+#define FRAG_BITMAP_BYTES(bits)         (((bits) + 7) / 8)
+#define FRAG_MATRIX_BITS(m)             (((uint32_t)(m) * ((m) + 1)) / 2)
+
+typedef enum {
+    FRAG_SESSION_IDLE = 0,
+    FRAG_SESSION_ACTIVE,
+    FRAG_SESSION_COMPLETE
+} frag_session_state_t;
+
+typedef struct {
+    uint8_t   state;
+    uint8_t   mc_group_mask;
+    uint8_t   frag_size;
+    uint8_t   padding;
+    uint16_t  nb_frag;
+    uint16_t  nb_received;      // Uncoded and coded fragments received
+    uint16_t  nb_missing;       // Matrix size, missing uncoded fragments when decoding started
+    uint16_t  rank;             // Rows stored in the parity matrix
+    uint32_t  descriptor;
+    bd_addr_t scratch_addr;     // Reduced row data, one fragment per matrix row
+    bool      decoding;
+    bool      matrix_overflow;
+    uint32_t  decode_time_us;   // Time spent processing coded fragments and back substitution
+} frag_session_t;
+
+static frag_session_t frag_session;
+static BlockDevice   *frag_bd = NULL;
+static Timer          frag_timer;
+
+static uint8_t   frag_received[FRAG_BITMAP_BYTES(FRAG_MAX_NB)];
+static uint8_t   frag_row[FRAG_BITMAP_BYTES(FRAG_MAX_NB)];
+static uint16_t  frag_missing[FRAG_MAX_REDUNDANCY];
+static uint8_t   frag_matrix[FRAG_BITMAP_BYTES(FRAG_MATRIX_BITS(FRAG_MAX_REDUNDANCY))];
+static uint8_t   frag_stored[FRAG_BITMAP_BYTES(FRAG_MAX_REDUNDANCY)];
+static uint8_t   frag_mrow[FRAG_BITMAP_BYTES(FRAG_MAX_REDUNDANCY)];
+static uint8_t   frag_data[FRAG_MAX_SIZE];
+static uint8_t   frag_tmp[FRAG_MAX_SIZE];
+
+static uint8_t   frag_page[FRAG_PAGE_SIZE];
+static bd_addr_t frag_page_addr  = 0;
+static bool      frag_page_valid = false;
+static bool      frag_page_dirty = false;
+
+static inline bool frag_bit_get(const uint8_t *bitmap, uint32_t bit)
+{
+    return (bitmap[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static inline void frag_bit_set(uint8_t *bitmap, uint32_t bit)
+{
+    bitmap[bit >> 3] |= 1 << (bit & 7);
+}
+
+static inline void frag_bit_flip(uint8_t *bitmap, uint32_t bit)
+{
+    bitmap[bit >> 3] ^= 1 << (bit & 7);
+}
+
+static inline void frag_xor(uint8_t *dst, const uint8_t *src, uint8_t size)
+{
+    for(uint8_t i = 0; i < size; i++)
+        dst[i] ^= src[i];
+}
+
+// Bit index of (row, col) in the upper triangular matrix, col >= row
+static inline uint32_t frag_matrix_bit(uint16_t row, uint16_t col)
+{
+    uint32_t m = frag_session.nb_missing;
+
+    return row * m - ((uint32_t)row * (row - 1)) / 2 + (col - row);
+}
+
+size_t frag_session_ram_usage()
+{
+    return sizeof(frag_session) + sizeof(frag_received) + sizeof(frag_row) + sizeof(frag_missing) +
+           sizeof(frag_matrix) + sizeof(frag_stored) + sizeof(frag_mrow) + sizeof(frag_data) +
+           sizeof(frag_tmp) + sizeof(frag_page);
+}
+
+static int frag_page_flush()
+{
+    int rc = 0;
+
+    if(frag_page_dirty)
+    {
+        rc = frag_bd->program(frag_page, frag_page_addr, FRAG_PAGE_SIZE);
+        frag_page_dirty = false;
+    }
+
+    return rc;
+}
+
+static int frag_page_load(bd_addr_t addr)
+{
+    int rc;
+
+    if(frag_page_valid && (frag_page_addr == addr))
+        return 0;
+
+    rc = frag_page_flush();
+    if(rc == 0)
+        rc = frag_bd->read(frag_page, addr, FRAG_PAGE_SIZE);
+
+    frag_page_addr  = addr;
+    frag_page_valid = (rc == 0);
+
+    return rc;
+}
+
+static int frag_storage_write(bd_addr_t addr, const uint8_t *buffer, size_t size)
+{
+    while(size > 0)
+    {
+        bd_addr_t offset = addr % FRAG_PAGE_SIZE;
+        size_t    count  = FRAG_PAGE_SIZE - offset;
+
+        if(count > size)
+            count = size;
+
+        int rc = frag_page_load(addr - offset);
+        if(rc != 0)
+            return rc;
+
+        memcpy(frag_page + offset, buffer, count);
+        frag_page_dirty = true;
+
+        addr   += count;
+        buffer += count;
+        size   -= count;
+    }
+
+    return 0;
+}
+
+static int frag_storage_read(bd_addr_t addr, uint8_t *buffer, size_t size)
+{
+    while(size > 0)
+    {
+        bd_addr_t offset = addr % FRAG_PAGE_SIZE;
+        size_t    count  = FRAG_PAGE_SIZE - offset;
+
+        if(count > size)
+            count = size;
+
+        int rc = frag_page_load(addr - offset);
+        if(rc != 0)
+            return rc;
+
+        memcpy(buffer, frag_page + offset, count);
+
+        addr   += count;
+        buffer += count;
+        size   -= count;
+    }
+
+    return 0;
+}
+
+static inline bd_addr_t frag_image_addr(uint16_t index)
+{
+    return (bd_addr_t)index * frag_session.frag_size;
+}
+
+static inline bd_addr_t frag_scratch_addr(uint16_t row)
+{
+    return frag_session.scratch_addr + (bd_addr_t)row * frag_session.frag_size;
+}
+
+static uint32_t frag_prbs23(uint32_t x)
+{
+    uint32_t b0 = x & 1;
+    uint32_t b1 = (x & 0x20) >> 5;
+
+    return (x >> 1) + ((b0 ^ b1) << 22);
+}
+
+// Parity matrix row of coded fragment n (1 based) over m uncoded fragments
+static void frag_parity_row(uint16_t n, uint16_t m, uint8_t *row)
+{
+    uint32_t m_temp   = ((m & (m - 1)) == 0) ? 1 : 0;
+    uint32_t x        = 1 + (1001 * (uint32_t)n);
+    uint16_t nb_coeff = 0;
+
+    memset(row, 0, FRAG_BITMAP_BYTES(m));
+
+    while(nb_coeff < (m >> 1))
+    {
+        uint32_t r = 1 << 16;
+
+        while(r >= m)
+        {
+            x = frag_prbs23(x);
+            r = x % (m + m_temp);
+        }
+        frag_bit_set(row, r);
+        nb_coeff++;
+    }
+}
+
+// Matrix column of a missing fragment, -1 if the fragment is not missing
+static int frag_missing_column(uint16_t index)
+{
+    int low  = 0;
+    int high = frag_session.nb_missing - 1;
+
+    while(low <= high)
+    {
+        int mid = (low + high) / 2;
+
+        if(frag_missing[mid] == index)
+            return mid;
+        else if(frag_missing[mid] < index)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+
+    return -1;
+}
+
+// Freeze the missing fragment list, this sizes the parity matrix
+static void frag_start_decoding()
+{
+    uint16_t missing = 0;
+
+    for(uint16_t i = 0; i < frag_session.nb_frag; i++)
+    {
+        if(!frag_bit_get(frag_received, i))
+        {
+            if(missing == FRAG_MAX_REDUNDANCY)
+            {
+                frag_session.matrix_overflow = true;
+                printf("FUOTA - too many missing fragments for the parity matrix\n");
+                return;
+            }
+            frag_missing[missing++] = i;
+        }
+    }
+
+    frag_session.nb_missing = missing;
+    frag_session.rank       = 0;
+    frag_session.decoding   = true;
+    memset(frag_matrix, 0, FRAG_BITMAP_BYTES(FRAG_MATRIX_BITS(missing)));
+    memset(frag_stored, 0, sizeof(frag_stored));
+}
+
+// Recover the missing fragments once the matrix has full rank
+static int frag_solve()
+{
+    uint16_t m = frag_session.nb_missing;
+
+    for(int row = m - 1; row >= 0; row--)
+    {
+        int rc = frag_storage_read(frag_scratch_addr(row), frag_data, frag_session.frag_size);
+
+        for(uint16_t col = row + 1; (col < m) && (rc == 0); col++)
+        {
+            if(frag_bit_get(frag_matrix, frag_matrix_bit(row, col)))
+            {
+                rc = frag_storage_read(frag_image_addr(frag_missing[col]), frag_tmp, frag_session.frag_size);
+                frag_xor(frag_data, frag_tmp, frag_session.frag_size);
+            }
+        }
+
+        if(rc == 0)
+            rc = frag_storage_write(frag_image_addr(frag_missing[row]), frag_data, frag_session.frag_size);
+
+        if(rc != 0)
+            return rc;
+
+        frag_bit_set(frag_received, frag_missing[row]);
+    }
+
+    return frag_page_flush();
+}
+
+// Reduce frag_mrow/frag_data against the stored rows, store it if it is independent
+static int frag_reduce_row()
+{
+    uint16_t m = frag_session.nb_missing;
+
+    for(uint16_t row = 0; row < m; row++)
+    {
+        if(!frag_bit_get(frag_mrow, row))
+            continue;
+
+        if(!frag_bit_get(frag_stored, row))
+        {
+            for(uint16_t col = row; col < m; col++)
+            {
+                if(frag_bit_get(frag_mrow, col))
+                    frag_bit_set(frag_matrix, frag_matrix_bit(row, col));
+            }
+            frag_bit_set(frag_stored, row);
+            frag_session.rank++;
+
+            return frag_storage_write(frag_scratch_addr(row), frag_data, frag_session.frag_size);
+        }
+
+        for(uint16_t col = row; col < m; col++)
+        {
+            if(frag_bit_get(frag_matrix, frag_matrix_bit(row, col)))
+                frag_bit_flip(frag_mrow, col);
+        }
+
+        int rc = frag_storage_read(frag_scratch_addr(row), frag_tmp, frag_session.frag_size);
+        if(rc != 0)
+            return rc;
+
+        frag_xor(frag_data, frag_tmp, frag_session.frag_size);
+    }
+
+    // Linearly dependent on the stored rows, nothing new
+    return 0;
+}
+
+static void frag_complete()
+{
+    frag_session.state = FRAG_SESSION_COMPLETE;
+    printf("FUOTA - image complete: %lu bytes, %u fragments received, %u recovered, decode %lu us, RAM %u bytes\n",
+        (uint32_t)frag_session.nb_frag * frag_session.frag_size - frag_session.padding,
+        frag_session.nb_received, frag_session.nb_missing,
+        frag_session.decode_time_us, frag_session_ram_usage());
+}
+
+int frag_session_init(BlockDevice *bd)
+{
+    frag_bd = bd;
+    memset(&frag_session, 0, sizeof(frag_session));
+
+    return frag_bd->init();
+}
+
+static uint8_t frag_session_setup(uint16_t nb_frag, uint8_t frag_size, uint8_t padding, uint8_t mc_group_mask, uint32_t descriptor)
+{
+    bd_size_t erase_size;
+    bd_size_t total;
+
+    if((nb_frag == 0) || (nb_frag > FRAG_MAX_NB) || (frag_size == 0) || (frag_size > FRAG_MAX_SIZE))
+        return FRAG_SETUP_NOT_ENOUGH_MEMORY;
+
+    if((FRAG_PAGE_SIZE % frag_bd->get_program_size()) || (FRAG_PAGE_SIZE % frag_bd->get_read_size()))
+        return FRAG_SETUP_NOT_ENOUGH_MEMORY;
+
+    memset(&frag_session, 0, sizeof(frag_session));
+    frag_session.nb_frag       = nb_frag;
+    frag_session.frag_size     = frag_size;
+    frag_session.padding       = padding;
+    frag_session.mc_group_mask = mc_group_mask;
+    frag_session.descriptor    = descriptor;
+
+    // Image followed by the scratch area for the reduced parity rows
+    frag_session.scratch_addr  = frag_image_addr(nb_frag);
+    frag_session.scratch_addr += (FRAG_PAGE_SIZE - frag_session.scratch_addr % FRAG_PAGE_SIZE) % FRAG_PAGE_SIZE;
+
+    erase_size = frag_bd->get_erase_size();
+    total      = frag_scratch_addr(FRAG_MAX_REDUNDANCY);
+    total      = ((total + erase_size - 1) / erase_size) * erase_size;
+    if(total > frag_bd->size())
+        return FRAG_SETUP_NOT_ENOUGH_MEMORY;
+
+    frag_page_valid = false;
+    frag_page_dirty = false;
+    if(frag_bd->erase(0, total) != 0)
+        return FRAG_SETUP_NOT_ENOUGH_MEMORY;
+
+    memset(frag_received, 0, sizeof(frag_received));
+    frag_session.state = FRAG_SESSION_ACTIVE;
+
+    printf("FUOTA - session setup: %u fragments of %u bytes, padding=%u\n", nb_frag, frag_size, padding);
+
+    return 0;
+}
+
+static int frag_on_fragment(uint16_t n, const uint8_t *payload, uint8_t size)
+{
+    int rc = 0;
+
+    if((frag_session.state != FRAG_SESSION_ACTIVE) || (size != frag_session.frag_size) || (n == 0))
+        return 0;
+
+    uint16_t index = n - 1;
+
+    if((index < frag_session.nb_frag) && !frag_session.decoding)
+    {
+        if(frag_bit_get(frag_received, index))
+            return 0;
+
+        rc = frag_storage_write(frag_image_addr(index), payload, size);
+        if(rc == 0)
+        {
+            frag_bit_set(frag_received, index);
+            frag_session.nb_received++;
+
+            if(frag_session.nb_received == frag_session.nb_frag)
+            {
+                rc = frag_page_flush();
+                frag_complete();
+            }
+        }
+        return rc;
+    }
+
+    if(frag_session.matrix_overflow)
+        return 0;
+
+    // Uncoded fragment that is not missing, a duplicate or one received before decoding started
+    if((index < frag_session.nb_frag) && (frag_missing_column(index) < 0))
+        return 0;
+
+    frag_timer.reset();
+    frag_timer.start();
+
+    if(!frag_session.decoding)
+        frag_start_decoding();
+
+    if(frag_session.decoding)
+    {
+        uint16_t m = frag_session.nb_missing;
+
+        memset(frag_mrow, 0, FRAG_BITMAP_BYTES(m));
+        memcpy(frag_data, payload, size);
+
+        if(index < frag_session.nb_frag)
+        {
+            // Late uncoded fragment, a row with a single missing fragment
+            frag_bit_set(frag_mrow, frag_missing_column(index));
+        }
+        else
+        {
+            uint16_t col = 0;
+
+            frag_parity_row(n - frag_session.nb_frag, frag_session.nb_frag, frag_row);
+
+            for(uint16_t i = 0; (i < frag_session.nb_frag) && (rc == 0); i++)
+            {
+                bool missing = (col < m) && (frag_missing[col] == i);
+
+                if(frag_bit_get(frag_row, i))
+                {
+                    if(missing)
+                    {
+                        frag_bit_set(frag_mrow, col);
+                    }
+                    else
+                    {
+                        rc = frag_storage_read(frag_image_addr(i), frag_tmp, size);
+                        frag_xor(frag_data, frag_tmp, size);
+                    }
+                }
+                if(missing)
+                    col++;
+            }
+        }
+
+        frag_session.nb_received++;
+        if(rc == 0)
+            rc = frag_reduce_row();
+
+        if((rc == 0) && (frag_session.rank == m))
+            rc = frag_solve();
+    }
+
+    frag_timer.stop();
+    frag_session.decode_time_us += frag_timer.read_us();
+
+    if((rc == 0) && frag_session.decoding && (frag_session.rank == frag_session.nb_missing))
+        frag_complete();
+
+    return rc;
+}
+
+/**
+ * Process a downlink received on the fragmentation port.
+ *
+ * @param buffer    Received payload, one or more fragmentation package commands
+ * @param size      Size of the payload
+ * @param multicast The payload was received on a multicast group
+ * @param answer    Buffer for the answers to send back on the fragmentation port
+ * @param max_size  Size of the answer buffer
+ * @returns         Size of the answer, 0 if nothing has to be sent
+ */
+uint8_t frag_session_process(const uint8_t *buffer, uint8_t size, bool multicast, uint8_t *answer, uint8_t max_size)
+{
+    uint8_t pos = 0;
+    uint8_t ans = 0;
+
+    while(pos < size)
+    {
+        uint8_t cmd = buffer[pos++];
+        uint8_t remaining = size - pos;
+
+        switch(cmd)
+        {
+            case FRAG_PACKAGE_VERSION_REQ:
+            {
+                if(ans + 3 <= max_size)
+                {
+                    answer[ans++] = FRAG_PACKAGE_VERSION_REQ;
+                    answer[ans++] = FRAG_PACKAGE_IDENTIFIER;
+                    answer[ans++] = FRAG_PACKAGE_VERSION;
+                }
+                break;
+            }
+            case FRAG_SESSION_STATUS_REQ:
+            {
+                if(remaining < 1)
+                    return ans;
+
+                uint8_t  param        = buffer[pos++];
+                bool     participants = param & 0x01;
+                uint8_t  frag_index   = (param >> 1) & 0x03;
+                uint16_t missing;
+
+                if((frag_index != 0) || (frag_session.state == FRAG_SESSION_IDLE))
+                    break;
+
+                if(frag_session.state == FRAG_SESSION_COMPLETE)
+                    missing = 0;
+                else if(frag_session.decoding)
+                    missing = frag_session.nb_missing - frag_session.rank;
+                else
+                    missing = frag_session.nb_frag - frag_session.nb_received;
+
+                if((!participants && (missing == 0)) || (ans + 5 > max_size))
+                    break;
+
+                answer[ans++] = FRAG_SESSION_STATUS_REQ;
+                answer[ans++] = frag_session.nb_received & 0xff;
+                answer[ans++] = ((frag_session.nb_received >> 8) & 0x3f) | (frag_index << 6);
+                answer[ans++] = (missing > 255) ? 255 : missing;
+                answer[ans++] = frag_session.matrix_overflow ? FRAG_STATUS_MATRIX_OVERFLOW : 0;
+                break;
+            }
+            case FRAG_SESSION_SETUP_REQ:
+            {
+                if(remaining < 10)
+                    return ans;
+
+                uint8_t  session    = buffer[pos];
+                uint8_t  frag_index = (session >> 4) & 0x03;
+                uint16_t nb_frag    = buffer[pos + 1] | (buffer[pos + 2] << 8);
+                uint8_t  frag_size  = buffer[pos + 3];
+                uint8_t  control    = buffer[pos + 4];
+                uint8_t  padding    = buffer[pos + 5];
+                uint32_t descriptor = buffer[pos + 6] | (buffer[pos + 7] << 8) | (buffer[pos + 8] << 16) | ((uint32_t)buffer[pos + 9] << 24);
+                uint8_t  status     = 0;
+                pos += 10;
+
+                if(frag_index != 0)
+                    status |= FRAG_SETUP_INDEX_UNSUPPORTED;
+                if(((control >> 3) & 0x07) != 0)
+                    status |= FRAG_SETUP_ENCODING_UNSUPPORTED;
+                if(status == 0)
+                    status = frag_session_setup(nb_frag, frag_size, padding, session & 0x0f, descriptor);
+
+                if(ans + 2 <= max_size)
+                {
+                    answer[ans++] = FRAG_SESSION_SETUP_REQ;
+                    answer[ans++] = status | (frag_index << 6);
+                }
+                break;
+            }
+            case FRAG_SESSION_DELETE_REQ:
+            {
+                if(remaining < 1)
+                    return ans;
+
+                uint8_t frag_index = buffer[pos++] & 0x03;
+                uint8_t status     = frag_index;
+
+                if((frag_index != 0) || (frag_session.state == FRAG_SESSION_IDLE))
+                    status |= FRAG_DELETE_NO_SESSION;
+                else
+                    memset(&frag_session, 0, sizeof(frag_session));
+
+                if(ans + 2 <= max_size)
+                {
+                    answer[ans++] = FRAG_SESSION_DELETE_REQ;
+                    answer[ans++] = status;
+                }
+                break;
+            }
+            case FRAG_DATA_FRAGMENT:
+            {
+                if(remaining < 2)
+                    return ans;
+
+                uint16_t index_and_n = buffer[pos] | (buffer[pos + 1] << 8);
+                pos += 2;
+
+                // The fragment payload takes the rest of the message
+                if(multicast && (frag_session.mc_group_mask == 0))
+                    return ans;
+
+                if((index_and_n >> 14) == 0)
+                {
+                    int rc = frag_on_fragment(index_and_n & 0x3fff, buffer + pos, size - pos);
+                    if(rc != 0)
+                        printf("FUOTA - block device error %d\n", rc);
+                }
+                return ans;
+            }
+            default:
+                printf("FUOTA - unknown command=%u\n", cmd);
+                return ans;
+        }
+    }
+
+    return ans;
+}
+
+void frag_session_print_status()
+{
+    static const char *states[] = { "idle", "active", "complete" };
+
+    printf("FUOTA Session         : %s\n", states[frag_session.state]);
+    if(frag_session.state != FRAG_SESSION_IDLE)
+    {
+        printf("FUOTA Fragments       : %u x %u bytes, %u received\n",
+            frag_session.nb_frag, frag_session.frag_size, frag_session.nb_received);
+        printf("FUOTA Parity Matrix   : %u / %u rows%s\n",
+            frag_session.rank, frag_session.nb_missing, frag_session.matrix_overflow ? " (overflow)" : "");
+        printf("FUOTA Decode Time     : %lu us\n", frag_session.decode_time_us);
+    }
+    printf("FUOTA RAM             : %u bytes\n", frag_session_ram_usage());
+}
+
+#endif // _FRAG_SESSION_HELPER_H
@@ -0,0 +1,178 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LOG_HELPER_H
+#define _LOG_HELPER_H
+
+#include "mbed.h"
+#include "mbed_events.h"
+#include "platform/FileHandle.h"
+#include "platform/mbed_critical.h"
+
+/**
+ * Console output that does not block the radio thread on the UART.
+ *
+ * LogConsole is installed as the stdio console, so printf and mbed_trace
+ * output go through it. Writes from the thread that called start(), the one
+ * dispatching the console queue, go to the UART directly. Writes from any
+ * other thread or from interrupts are copied to a RAM ring, a drain event on
+ * the console queue writes them out. A direct write drains the ring first so
+ * the output stays in order.
+ *
+ * When the ring is full the rest of a deferred write is dropped, the next
+ * drain reports how many bytes were lost.
+ */
+
+template<uint32_t N>
+class LogConsole : public mbed::FileHandle {
+    MBED_STATIC_ASSERT((N & (N - 1)) == 0, "LogConsole size must be a power of two");
+
+public:
+    LogConsole(RawSerial &serial) : _serial(serial), _queue(NULL), _thread(NULL), _head(0), _tail(0),
+                                    _dropped(0), _dropped_total(0), _drain_pending(false) {}
+
+    // Until this is called every write is direct
+    void start(EventQueue *queue)
+    {
+        _thread = ThisThread::get_id();
+        _queue  = queue;
+    }
+
+    virtual ssize_t write(const void *buffer, size_t size)
+    {
+        if(_queue && (core_util_is_isr_active() || (ThisThread::get_id() != _thread)))
+        {
+            defer((const uint8_t *)buffer, size);
+        }
+        else
+        {
+            drain();
+            output((const uint8_t *)buffer, size);
+        }
+
+        return size;
+    }
+
+    // Console input is read by the serial Rx interrupt
+    virtual ssize_t read(void *buffer, size_t size)
+    {
+        return -EAGAIN;
+    }
+
+    virtual off_t seek(off_t offset, int whence)
+    {
+        return -ESPIPE;
+    }
+
+    virtual int close()
+    {
+        return 0;
+    }
+
+    // stdio converts newlines for terminals only
+    virtual int isatty()
+    {
+        return 1;
+    }
+
+    // Bytes waiting to be written out
+    uint32_t pending() const
+    {
+        return _head - _tail;
+    }
+
+    uint32_t dropped() const
+    {
+        return _dropped_total;
+    }
+
+    // Console thread, writes the deferred output out
+    void drain()
+    {
+        uint8_t  chunk[32];
+        uint32_t count;
+        uint32_t dropped;
+
+        do
+        {
+            core_util_critical_section_enter();
+            count = _head - _tail;
+            if(count > sizeof(chunk))
+                count = sizeof(chunk);
+            for(uint32_t i = 0; i < count; i++)
+                chunk[i] = _buffer[(_tail + i) % N];
+            _tail += count;
+            dropped = _dropped;
+            if(count == 0)
+            {
+                _dropped       = 0;
+                _drain_pending = false;
+            }
+            core_util_critical_section_exit();
+
+            output(chunk, count);
+        } while(count > 0);
+
+        if(dropped > 0)
+        {
+            int size = snprintf((char *)chunk, sizeof(chunk), "[log: %lu bytes dropped]\r\n", dropped);
+            output(chunk, size);
+        }
+    }
+
+private:
+    void defer(const uint8_t *buffer, size_t size)
+    {
+        uint32_t count;
+        bool     post;
+
+        core_util_critical_section_enter();
+        count = N - (_head - _tail);
+        if(count > size)
+            count = size;
+        for(uint32_t i = 0; i < count; i++)
+            _buffer[(_head + i) % N] = buffer[i];
+        _head          += count;
+        _dropped       += size - count;
+        _dropped_total += size - count;
+        post            = !_drain_pending;
+        _drain_pending  = true;
+        core_util_critical_section_exit();
+
+        // The pending flag is cleared again when the queue is full, the next write retries
+        if(post && !_queue->call(this, &LogConsole::drain))
+            _drain_pending = false;
+    }
+
+    void output(const uint8_t *buffer, uint32_t size)
+    {
+        for(uint32_t i = 0; i < size; i++)
+            _serial.putc(buffer[i]);
+    }
+
+    RawSerial        &_serial;
+    EventQueue       *_queue;
+    osThreadId_t      _thread;
+    uint8_t           _buffer[N];
+    uint32_t          _head;
+    uint32_t          _tail;
+    uint32_t          _dropped;
+    uint32_t          _dropped_total;
+    volatile bool     _drain_pending;
+};
+
+#endif // _LOG_HELPER_H
@@ -27,65 +27,92 @@
 #define SX1272   0xFF
 #define SX1276   0xEE
 #define SX126X   0xDD
+#define SIM      0xCC
+
+/**
+ * lora_radio_t is the driver type selected by MBED_CONF_APP_LORA_RADIO. The
+ * LoRaWAN stack only sees the LoRaRadio base, see radio_timing_helper.h for
+ * the time the stack takes to open the RX windows.
+ */
+
+#if (MBED_CONF_APP_LORA_RADIO == SX1272) || (MBED_CONF_APP_LORA_RADIO == SX1276)
 
 #if (MBED_CONF_APP_LORA_RADIO == SX1272)
+typedef SX1272_LoRaRadio lora_radio_t;
+#define LORA_RADIO_NAME "SX1272"
+#else
+typedef SX1276_LoRaRadio lora_radio_t;
+#define LORA_RADIO_NAME "SX1276"
+#endif
 
-SX1272_LoRaRadio radio(MBED_CONF_APP_LORA_SPI_MOSI,
-                       MBED_CONF_APP_LORA_SPI_MISO,
-                       MBED_CONF_APP_LORA_SPI_SCLK,
-                       MBED_CONF_APP_LORA_CS,
-                       MBED_CONF_APP_LORA_RESET,
-                       MBED_CONF_APP_LORA_DIO0,
-                       MBED_CONF_APP_LORA_DIO1,
-                       MBED_CONF_APP_LORA_DIO2,
-                       MBED_CONF_APP_LORA_DIO3,
-                       MBED_CONF_APP_LORA_DIO4,
-                       MBED_CONF_APP_LORA_DIO5,
-                       MBED_CONF_APP_LORA_RF_SWITCH_CTL1,
-                       MBED_CONF_APP_LORA_RF_SWITCH_CTL2,
-                       MBED_CONF_APP_LORA_TXCTL,
-                       MBED_CONF_APP_LORA_RXCTL,
-                       MBED_CONF_APP_LORA_ANT_SWITCH,
-                       MBED_CONF_APP_LORA_PWR_AMP_CTL,
-                       MBED_CONF_APP_LORA_TCXO);
-
-#elif (MBED_CONF_APP_LORA_RADIO == SX1276)
-
-SX1276_LoRaRadio radio(MBED_CONF_APP_LORA_SPI_MOSI,
-                       MBED_CONF_APP_LORA_SPI_MISO,
-                       MBED_CONF_APP_LORA_SPI_SCLK,
-                       MBED_CONF_APP_LORA_CS,
-                       MBED_CONF_APP_LORA_RESET,
-                       MBED_CONF_APP_LORA_DIO0,
-                       MBED_CONF_APP_LORA_DIO1,
-                       MBED_CONF_APP_LORA_DIO2,
-                       MBED_CONF_APP_LORA_DIO3,
-                       MBED_CONF_APP_LORA_DIO4,
-                       MBED_CONF_APP_LORA_DIO5,
-                       MBED_CONF_APP_LORA_RF_SWITCH_CTL1,
-                       MBED_CONF_APP_LORA_RF_SWITCH_CTL2,
-                       MBED_CONF_APP_LORA_TXCTL,
-                       MBED_CONF_APP_LORA_RXCTL,
-                       MBED_CONF_APP_LORA_ANT_SWITCH,
-                       MBED_CONF_APP_LORA_PWR_AMP_CTL,
-                       MBED_CONF_APP_LORA_TCXO);
+#define LORA_RADIO_ARGS MBED_CONF_APP_LORA_SPI_MOSI,        \
+                        MBED_CONF_APP_LORA_SPI_MISO,        \
+                        MBED_CONF_APP_LORA_SPI_SCLK,        \
+                        MBED_CONF_APP_LORA_CS,              \
+                        MBED_CONF_APP_LORA_RESET,           \
+                        MBED_CONF_APP_LORA_DIO0,            \
+                        MBED_CONF_APP_LORA_DIO1,            \
+                        MBED_CONF_APP_LORA_DIO2,            \
+                        MBED_CONF_APP_LORA_DIO3,            \
+                        MBED_CONF_APP_LORA_DIO4,            \
+                        MBED_CONF_APP_LORA_DIO5,            \
+                        MBED_CONF_APP_LORA_RF_SWITCH_CTL1,  \
+                        MBED_CONF_APP_LORA_RF_SWITCH_CTL2,  \
+                        MBED_CONF_APP_LORA_TXCTL,           \
+                        MBED_CONF_APP_LORA_RXCTL,           \
+                        MBED_CONF_APP_LORA_ANT_SWITCH,      \
+                        MBED_CONF_APP_LORA_PWR_AMP_CTL,     \
+                        MBED_CONF_APP_LORA_TCXO
 
 #elif (MBED_CONF_APP_LORA_RADIO == SX126X)
 
-SX126X_LoRaRadio radio(MBED_CONF_APP_LORA_SPI_MOSI,
-                       MBED_CONF_APP_LORA_SPI_MISO,
-                       MBED_CONF_APP_LORA_SPI_SCLK,
-                       MBED_CONF_APP_LORA_CS,
-                       MBED_CONF_APP_LORA_RESET,
-                       MBED_CONF_APP_LORA_DIO1,
-                       MBED_CONF_APP_LORA_BUSY,
-                       MBED_CONF_APP_LORA_FREQ_SEL,
-                       MBED_CONF_APP_LORA_DEV_SEL,
-                       MBED_CONF_APP_LORA_TCXO,
-                       MBED_CONF_APP_LORA_ANT_SWITCH);
+typedef SX126X_LoRaRadio lora_radio_t;
+#define LORA_RADIO_NAME "SX126X"
+
+#define LORA_RADIO_ARGS MBED_CONF_APP_LORA_SPI_MOSI,        \
+                        MBED_CONF_APP_LORA_SPI_MISO,        \
+                        MBED_CONF_APP_LORA_SPI_SCLK,        \
+                        MBED_CONF_APP_LORA_CS,              \
+                        MBED_CONF_APP_LORA_RESET,           \
+                        MBED_CONF_APP_LORA_DIO1,            \
+                        MBED_CONF_APP_LORA_BUSY,            \
+                        MBED_CONF_APP_LORA_FREQ_SEL,        \
+                        MBED_CONF_APP_LORA_DEV_SEL,         \
+                        MBED_CONF_APP_LORA_TCXO,            \
+                        MBED_CONF_APP_LORA_ANT_SWITCH
+
+#elif (MBED_CONF_APP_LORA_RADIO == SIM)
+#include "sim_radio_helper.h"
+
+typedef SimLoRaRadio lora_radio_t;
+#define LORA_RADIO_NAME "SIM"
+
+// Channel model and gateway layout of the simulated radio
+static const sim_channel_config_t sim_channel_config = {
+    MBED_CONF_APP_SIM_GATEWAYS,
+    MBED_CONF_APP_SIM_GATEWAY_SPACING,
+    { MBED_CONF_APP_SIM_DEVICE_X, MBED_CONF_APP_SIM_DEVICE_Y },
+    MBED_CONF_APP_SIM_BACKGROUND_DEVICES,
+    MBED_CONF_APP_SIM_BACKGROUND_INTERVAL,
+    MBED_CONF_APP_SIM_AREA_RADIUS,
+    MBED_CONF_APP_SIM_CHANNELS
+};
+
+#define LORA_RADIO_ARGS sim_channel_config, MBED_CONF_APP_SIM_SEED
+
+#else
+#error "Unknown LoRa radio specified (SX1272,SX1276, SX126X, SIM are valid)"
+#endif
+
+// Radio states are timed for the energy model, see energy_helper.h
+#include "energy_helper.h"
+
+#if MBED_CONF_APP_RADIO_TIMING
+#include "radio_timing_helper.h"
 
+RadioTiming<RadioEnergy<lora_radio_t> > radio(LORA_RADIO_ARGS);
 #else
-#error "Unknown LoRa radio specified (SX1272,SX1276, SX126X are valid)"
+RadioEnergy<lora_radio_t> radio(LORA_RADIO_ARGS);
 #endif
 
 #endif /* APP_LORA_RADIO_HELPER_H_ */
@@ -21,17 +21,22 @@
 #include "mbed.h"
 #include "mbed_mem_trace.h"
 
+// Upper bound on the number of threads reported, keeps the helper free of heap allocation
+#define MEMORY_HELPER_MAX_THREADS 8
+
 void print_memory_info() {
 #if MBED_CONF_RTOS_PRESENT
-    // allocate enough room for every thread's stack statistics
-    int cnt = osThreadGetCount();
-    mbed_stats_stack_t *stats = (mbed_stats_stack_t*) malloc(cnt * sizeof(mbed_stats_stack_t));
+    static mbed_stats_stack_t stats[MEMORY_HELPER_MAX_THREADS];
 
-    cnt = mbed_stats_stack_get_each(stats, cnt);
+    int cnt = mbed_stats_stack_get_each(stats, MEMORY_HELPER_MAX_THREADS);
     for (int i = 0; i < cnt; i++) {
         printf("Thread: 0x%lX, Stack size: %lu / %lu\r\n", stats[i].thread_id, stats[i].max_size, stats[i].reserved_size);
     }
-    free(stats);
+
+    uint32_t threads = osThreadGetCount();
+    if (threads > (uint32_t)cnt) {
+        printf("Threads not shown: %lu, raise MEMORY_HELPER_MAX_THREADS\r\n", threads - cnt);
+    }
 #endif
 
     // Grab the heap statistics
@@ -0,0 +1,827 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _NS_EMULATOR_HELPER_H
+#define _NS_EMULATOR_HELPER_H
+
+#include "mbed.h"
+#include "mbed_events.h"
+#include "lorawan_types.h"
+#include "mbedtls/aes.h"
+#include "mbedtls/cmac.h"
+#include "sim_radio_helper.h"
+
+/**
+ * Network server stand-in for the simulated radio.
+ *
+ * Serves one device in the same firmware image, behind SimLoRaRadio:
+ * - OTAA join with LoRaWAN 1.0 keys. The JoinAccept has OptNeg cleared, so
+ *   a 1.1 stack falls back to 1.0 (the application uses AppKey as NwkKey).
+ * - Uplink MIC check, ACK of confirmed uplinks.
+ * - LinkCheckAns, DeviceTimeAns and PingSlotInfoAns in the next RX1.
+ * - Class B beacons once the device asked for the time, with NetID and
+ *   gateway id in the gateway specific field.
+ * - Scripted downlinks on the configuration port. Class A gets them in RX1,
+ *   Class B in the next ping slot and Class C right away in RX2.
+ *
+ * The script is a list of "<seconds>:<hex command>" entries separated by
+ * spaces, all times count from the JoinAccept. A rejoin cancels the rest of
+ * the script and starts it again. The device reports each command it
+ * receives with ns_emu_command_received(), the delay from queuing the command
+ * to the application handling it is accumulated per device class. A command
+ * not confirmed NS_RETRY_DELAY_MS after its downlink started is sent again,
+ * in the next ping slot, RX2 or RX1 of the next uplink, so downlinks the
+ * device missed show up in the latency instead of being lost.
+ *
+ * Downlink channels follow US915 when the uplinks are in 902-928 MHz and
+ * EU868 otherwise.
+ */
+
+#define NS_SCRIPT_MAX               16
+#define NS_COMMAND_MAX              16
+#define NS_RX1_DELAY_US             1000000
+#define NS_JOIN_ACCEPT_DELAY_US     5000000
+#define NS_BEACON_PERIOD_S          128
+#define NS_BEACON_DELAY_US          1500
+#define NS_BEACON_RESERVED_US       2120000
+#define NS_PING_SLOT_US             30000
+#define NS_BEACON_LEAD_MS           5000
+#define NS_NET_ID                   0x000013
+#define NS_CLASS_C_DELAY_US         50000
+#define NS_RETRY_DELAY_MS           3000
+
+// MAC command identifiers
+#define NS_RESET_IND                0x01
+#define NS_LINK_CHECK               0x02
+#define NS_REKEY_IND                0x0B
+#define NS_DEVICE_TIME              0x0D
+#define NS_PING_SLOT_INFO           0x10
+#define NS_DEVICE_MODE              0x20
+
+typedef struct {
+    uint32_t at_s;
+    uint8_t  size;
+    uint8_t  data[NS_COMMAND_MAX];
+} ns_script_entry_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_ms;
+    uint32_t max_ms;
+    uint32_t total_ms;
+} ns_latency_t;
+
+static SimLoRaRadio      *ns_radio = NULL;
+static EventQueue        *ns_queue = NULL;
+static uint8_t            ns_app_key[16];
+static uint8_t            ns_config_port;
+
+// Session
+static bool               ns_joined = false;
+static uint32_t           ns_dev_addr;
+static uint8_t            ns_nwk_skey[16];
+static uint8_t            ns_app_skey[16];
+static uint32_t           ns_fcnt_up;
+static uint32_t           ns_fcnt_down;
+static uint64_t           ns_join_us;             // JoinAccept, the script time base
+static bool               ns_us915 = true;
+static device_class_t     ns_device_class = CLASS_A;
+static bool               ns_ping_slot_info = false;
+static uint8_t            ns_ping_periodicity;
+static bool               ns_beacons = false;
+
+// MAC answers for the next downlink
+static uint8_t            ns_fopts[15];
+static uint8_t            ns_fopts_size = 0;
+
+// Script and the command waiting for the device
+static ns_script_entry_t  ns_script[NS_SCRIPT_MAX];
+static uint8_t            ns_script_count = 0;
+static uint8_t            ns_script_next = 0;
+static int                ns_script_event_id = 0;
+static ns_script_entry_t  ns_pending;
+static bool               ns_pending_valid = false;
+static bool               ns_pending_sent = false;
+static uint64_t           ns_pending_us;
+static ns_latency_t       ns_latency[3];
+static uint32_t           ns_commands_sent = 0;
+static uint32_t           ns_commands_retried = 0;
+static uint32_t           ns_commands_lost = 0;     // Replaced by the next script entry before they arrived
+static int                ns_retry_event_id = 0;
+
+static uint64_t           ns_gps_start_ms;
+
+static void ns_aes_encrypt(const uint8_t *key, const uint8_t *in, uint8_t *out)
+{
+    mbedtls_aes_context ctx;
+
+    mbedtls_aes_init(&ctx);
+    mbedtls_aes_setkey_enc(&ctx, key, 128);
+    mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, in, out);
+    mbedtls_aes_free(&ctx);
+}
+
+static void ns_aes_decrypt(const uint8_t *key, const uint8_t *in, uint8_t *out)
+{
+    mbedtls_aes_context ctx;
+
+    mbedtls_aes_init(&ctx);
+    mbedtls_aes_setkey_dec(&ctx, key, 128);
+    mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_DECRYPT, in, out);
+    mbedtls_aes_free(&ctx);
+}
+
+static uint32_t ns_cmac(const uint8_t *key, const uint8_t *b0, const uint8_t *msg, uint8_t size)
+{
+    mbedtls_cipher_context_t ctx;
+    uint8_t out[16];
+
+    mbedtls_cipher_init(&ctx);
+    mbedtls_cipher_setup(&ctx, mbedtls_cipher_info_from_type(MBEDTLS_CIPHER_AES_128_ECB));
+    mbedtls_cipher_cmac_starts(&ctx, key, 128);
+    if(b0)
+        mbedtls_cipher_cmac_update(&ctx, b0, 16);
+    mbedtls_cipher_cmac_update(&ctx, msg, size);
+    mbedtls_cipher_cmac_finish(&ctx, out);
+    mbedtls_cipher_free(&ctx);
+
+    return out[0] | (out[1] << 8) | (out[2] << 16) | ((uint32_t)out[3] << 24);
+}
+
+static void ns_put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static uint32_t ns_get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// B0 block of the data frame MIC
+static void ns_b0(uint8_t *b0, uint8_t dir, uint32_t fcnt, uint8_t size)
+{
+    memset(b0, 0, 16);
+    b0[0]  = 0x49;
+    b0[5]  = dir;
+    ns_put32(b0 + 6, ns_dev_addr);
+    ns_put32(b0 + 10, fcnt);
+    b0[15] = size;
+}
+
+static void ns_payload_crypt(const uint8_t *key, uint8_t dir, uint32_t fcnt, uint8_t *data, uint8_t size)
+{
+    uint8_t a[16], s[16];
+
+    for(uint8_t block = 0; block * 16 < size; block++)
+    {
+        memset(a, 0, sizeof(a));
+        a[0]  = 0x01;
+        a[5]  = dir;
+        ns_put32(a + 6, ns_dev_addr);
+        ns_put32(a + 10, fcnt);
+        a[15] = block + 1;
+        ns_aes_encrypt(key, a, s);
+
+        for(uint8_t i = 0; i < 16 && block * 16 + i < size; i++)
+            data[block * 16 + i] ^= s[i];
+    }
+}
+
+uint64_t ns_gps_ms(uint64_t sim_us)
+{
+    return ns_gps_start_ms + sim_us / 1000;
+}
+
+static uint64_t ns_sim_us(uint64_t gps_ms)
+{
+    return (gps_ms - ns_gps_start_ms) * 1000;
+}
+
+// Beacon and ping slot channel and data rate
+static void ns_class_b_channel(uint32_t beacon_time, bool beacon, uint32_t &freq, uint8_t &sf, uint32_t &bandwidth_hz)
+{
+    if(ns_us915)
+    {
+        uint32_t channel = ((beacon ? 0 : ns_dev_addr) + beacon_time / NS_BEACON_PERIOD_S) % 8;
+
+        freq = 923300000 + channel * 600000;
+        sf = 12;
+        bandwidth_hz = 500000;
+    }
+    else
+    {
+        freq = 869525000;
+        sf = 9;
+        bandwidth_hz = 125000;
+    }
+}
+
+// RX1 follows the uplink: same channel and SF in EU868, US915 maps the
+// uplink channel to one of 8 downlink channels at 500 kHz (RX1DROffset 0)
+static void ns_rx1_channel(const sim_uplink_t &uplink, uint32_t &freq, uint8_t &sf, uint32_t &bandwidth_hz)
+{
+    freq = uplink.freq;
+    sf = uplink.sf;
+    bandwidth_hz = uplink.bandwidth_hz;
+
+    if(!ns_us915)
+        return;
+
+    if(uplink.bandwidth_hz == 125000)
+    {
+        freq = 923300000 + ((uplink.freq - 902300000) / 200000 % 8) * 600000;
+    }
+    else
+    {
+        freq = 923300000 + ((uplink.freq - 903000000) / 1600000 % 8) * 600000;
+        sf = (sf > 7) ? sf - 1 : 7;
+    }
+    bandwidth_hz = 500000;
+}
+
+static void ns_rx2_channel(uint32_t &freq, uint8_t &sf, uint32_t &bandwidth_hz)
+{
+    freq = ns_us915 ? 923300000 : 869525000;
+    sf = 12;
+    bandwidth_hz = ns_us915 ? 500000 : 125000;
+}
+
+// Data downlink with the pending MAC answers and optionally an application payload
+static uint8_t ns_build_downlink(uint8_t *frame, bool ack, const uint8_t *payload, uint8_t size, uint8_t port)
+{
+    uint8_t len = 0;
+    uint8_t b0[16];
+
+    frame[len++] = 0x60;
+    ns_put32(frame + len, ns_dev_addr);
+    len += 4;
+    frame[len++] = (ack ? 0x20 : 0) | ns_fopts_size;
+    frame[len++] = ns_fcnt_down & 0xff;
+    frame[len++] = (ns_fcnt_down >> 8) & 0xff;
+    memcpy(frame + len, ns_fopts, ns_fopts_size);
+    len += ns_fopts_size;
+    ns_fopts_size = 0;
+
+    if(payload)
+    {
+        frame[len++] = port;
+        memcpy(frame + len, payload, size);
+        ns_payload_crypt(port ? ns_app_skey : ns_nwk_skey, 1, ns_fcnt_down, frame + len, size);
+        len += size;
+    }
+
+    ns_b0(b0, 1, ns_fcnt_down, len);
+    ns_put32(frame + len, ns_cmac(ns_nwk_skey, b0, frame, len));
+    len += 4;
+
+    ns_fcnt_down++;
+    return len;
+}
+
+static void ns_schedule_pending();
+
+static void ns_cancel_retry()
+{
+    if(ns_retry_event_id)
+        ns_queue->cancel(ns_retry_event_id);
+    ns_retry_event_id = 0;
+}
+
+// The downlink of the pending command was not confirmed, send it again
+static void ns_retry_event()
+{
+    ns_retry_event_id = 0;
+    if(!ns_pending_valid || !ns_pending_sent)
+        return;
+
+    ns_pending_sent = false;
+    ns_commands_retried++;
+    ns_schedule_pending();
+}
+
+// The pending command went out in a downlink starting at start_us
+static void ns_pending_queued(uint64_t start_us)
+{
+    uint64_t now = ns_radio->now_us();
+
+    ns_pending_sent = true;
+    ns_commands_sent++;
+
+    ns_cancel_retry();
+    ns_retry_event_id = ns_queue->call_in(((start_us > now) ? (start_us - now) / 1000 : 0) + NS_RETRY_DELAY_MS,
+        ns_retry_event);
+}
+
+static void ns_send_pending(uint64_t start_us, uint32_t freq, uint8_t sf, uint32_t bandwidth_hz, int8_t gateway)
+{
+    uint8_t frame[64];
+    uint8_t len = ns_build_downlink(frame, false, ns_pending.data, ns_pending.size, ns_config_port);
+
+    if(ns_radio->queue_downlink(frame, len, freq, sf, bandwidth_hz, start_us, gateway))
+        ns_pending_queued(start_us);
+}
+
+// Next ping slot starting at or after gps_ms
+static uint64_t ns_next_ping_slot_ms(uint64_t gps_ms)
+{
+    uint32_t ping_nb     = 1 << (7 - ns_ping_periodicity);
+    uint32_t ping_period = 4096 / ping_nb;
+    uint32_t beacon_time = (uint32_t)(gps_ms / 1000 / NS_BEACON_PERIOD_S) * NS_BEACON_PERIOD_S;
+
+    for(uint8_t period = 0; period < 2; period++, beacon_time += NS_BEACON_PERIOD_S)
+    {
+        uint8_t key[16] = { 0 };
+        uint8_t block[16] = { 0 };
+        uint8_t rand[16];
+
+        ns_put32(block, beacon_time);
+        ns_put32(block + 4, ns_dev_addr);
+        ns_aes_encrypt(key, block, rand);
+
+        uint32_t offset = (rand[0] + rand[1] * 256) % ping_period;
+        for(uint32_t n = 0; n < ping_nb; n++)
+        {
+            uint64_t slot_ms = (uint64_t)beacon_time * 1000 + NS_BEACON_RESERVED_US / 1000 + ((offset + n * ping_period) * NS_PING_SLOT_US) / 1000;
+            if(slot_ms >= gps_ms)
+                return slot_ms;
+        }
+    }
+
+    return 0;
+}
+
+// Class B and C commands go out as soon as possible, otherwise the command waits for the next uplink
+static void ns_schedule_pending()
+{
+    uint64_t now = ns_radio->now_us();
+    uint32_t freq, bandwidth_hz;
+    uint8_t  sf;
+
+    if(!ns_pending_valid)
+        return;
+
+    if((ns_device_class == CLASS_B) && ns_ping_slot_info)
+    {
+        uint64_t slot_ms = ns_next_ping_slot_ms(ns_gps_ms(now) + 100);
+
+        ns_class_b_channel((uint32_t)(slot_ms / 1000), false, freq, sf, bandwidth_hz);
+        ns_send_pending(ns_sim_us(slot_ms), freq, sf, bandwidth_hz, 0);
+    }
+    else if(ns_device_class == CLASS_C)
+    {
+        ns_rx2_channel(freq, sf, bandwidth_hz);
+        ns_send_pending(now + NS_CLASS_C_DELAY_US, freq, sf, bandwidth_hz, 0);
+    }
+}
+
+static void ns_script_event();
+
+// Queues the next script entry at its time after the JoinAccept
+static void ns_script_schedule()
+{
+    ns_script_event_id = 0;
+    if(ns_script_next >= ns_script_count)
+        return;
+
+    uint64_t at_us = ns_join_us + (uint64_t)ns_script[ns_script_next].at_s * 1000000;
+    uint64_t now = ns_radio->now_us();
+
+    ns_script_event_id = ns_queue->call_in((at_us > now) ? (at_us - now) / 1000 : 0, ns_script_event);
+}
+
+static void ns_script_event()
+{
+    if(ns_script_next >= ns_script_count)
+        return;
+
+    if(ns_pending_valid)
+        ns_commands_lost++;
+    ns_cancel_retry();
+
+    ns_pending       = ns_script[ns_script_next++];
+    ns_pending_valid = true;
+    ns_pending_sent  = false;
+    ns_pending_us    = ns_radio->now_us();
+    ns_schedule_pending();
+
+    ns_script_schedule();
+}
+
+static uint16_t ns_crc16(const uint8_t *data, uint8_t size)
+{
+    uint16_t crc = 0;
+
+    // CRC-16/CCITT as in IEEE 802.15.4 (reflected 0x1021, initial value 0)
+    for(uint8_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for(uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+    }
+
+    return crc;
+}
+
+static void ns_beacon_event()
+{
+    uint64_t now_gps_ms = ns_gps_ms(ns_radio->now_us());
+    uint32_t beacon_time = (uint32_t)(now_gps_ms / 1000 / NS_BEACON_PERIOD_S + 1) * NS_BEACON_PERIOD_S;
+    uint8_t  rfu1 = ns_us915 ? 5 : 2;
+    uint8_t  rfu2 = ns_us915 ? 3 : 0;
+    uint8_t  beacon[23];
+    uint8_t  len = 0;
+    uint32_t freq, bandwidth_hz;
+    uint8_t  sf;
+
+    memset(beacon, 0, sizeof(beacon));
+    len = rfu1;
+    ns_put32(beacon + len, beacon_time);
+    len += 4;
+    beacon[len] = ns_crc16(beacon, len) & 0xff;
+    beacon[len + 1] = ns_crc16(beacon, len) >> 8;
+    len += 2;
+
+    // InfoDesc 3: NetID and gateway id
+    uint8_t gw_start = len;
+    beacon[len++] = 3;
+    beacon[len++] = NS_NET_ID & 0xff;
+    beacon[len++] = (NS_NET_ID >> 8) & 0xff;
+    beacon[len++] = (NS_NET_ID >> 16) & 0xff;
+    beacon[len++] = 0x01;
+    beacon[len++] = 0x00;
+    beacon[len++] = 0x00;
+    len += rfu2;
+    uint16_t crc = ns_crc16(beacon + gw_start, len - gw_start);
+    beacon[len++] = crc & 0xff;
+    beacon[len++] = crc >> 8;
+
+    ns_class_b_channel(beacon_time, true, freq, sf, bandwidth_hz);
+    ns_radio->queue_downlink(beacon, len, freq, sf, bandwidth_hz, ns_sim_us((uint64_t)beacon_time * 1000) + NS_BEACON_DELAY_US, 0);
+
+    // Next beacon is queued ahead of its time
+    uint64_t next_ms = (uint64_t)(beacon_time + NS_BEACON_PERIOD_S) * 1000 - NS_BEACON_LEAD_MS;
+    ns_queue->call_in(next_ms - now_gps_ms, ns_beacon_event);
+}
+
+static void ns_join(const uint8_t *frame, uint8_t size, const sim_uplink_t &uplink)
+{
+    uint8_t accept[17];
+    uint8_t block[16];
+    uint32_t app_nonce = sim_random() & 0xffffff;
+
+    if((size != 23) || (ns_cmac(ns_app_key, NULL, frame, 19) != ns_get32(frame + 19)))
+    {
+        printf("NS: JoinRequest MIC error\n");
+        return;
+    }
+
+    ns_dev_addr = 0x26000000 | (sim_random() & 0x01ffffff);
+
+    accept[0] = 0x20;
+    accept[1] = app_nonce & 0xff;
+    accept[2] = (app_nonce >> 8) & 0xff;
+    accept[3] = (app_nonce >> 16) & 0xff;
+    accept[4] = NS_NET_ID & 0xff;
+    accept[5] = (NS_NET_ID >> 8) & 0xff;
+    accept[6] = (NS_NET_ID >> 16) & 0xff;
+    ns_put32(accept + 7, ns_dev_addr);
+    accept[11] = ns_us915 ? 8 : 0;          // OptNeg=0, RX1DROffset=0, RX2 data rate
+    accept[12] = NS_RX1_DELAY_US / 1000000;
+    ns_put32(accept + 13, ns_cmac(ns_app_key, NULL, accept, 13));
+
+    // Session keys from AppNonce, NetID and DevNonce
+    memset(block, 0, sizeof(block));
+    memcpy(block + 1, accept + 1, 6);
+    memcpy(block + 7, frame + 17, 2);
+    block[0] = 0x01;
+    ns_aes_encrypt(ns_app_key, block, ns_nwk_skey);
+    block[0] = 0x02;
+    ns_aes_encrypt(ns_app_key, block, ns_app_skey);
+
+    // The server decrypts so the device can use AES encrypt only
+    ns_aes_decrypt(ns_app_key, accept + 1, block);
+    memcpy(accept + 1, block, 16);
+
+    ns_joined          = true;
+    ns_fcnt_up         = 0;
+    ns_fcnt_down       = 0;
+    ns_fopts_size      = 0;
+    ns_ping_slot_info  = false;
+    ns_join_us         = uplink.end_us + NS_JOIN_ACCEPT_DELAY_US;
+
+    uint32_t freq, bandwidth_hz;
+    uint8_t  sf;
+
+    ns_rx1_channel(uplink, freq, sf, bandwidth_hz);
+    ns_radio->queue_downlink(accept, sizeof(accept), freq, sf, bandwidth_hz, ns_join_us, uplink.link.gateway);
+    printf("NS: Join accepted, DevAddr=%08lx\n", ns_dev_addr);
+
+    // A rejoin starts the script again, the command of the old session is dropped
+    if(ns_script_event_id)
+        ns_queue->cancel(ns_script_event_id);
+    ns_cancel_retry();
+    ns_pending_valid = false;
+    ns_script_next   = 0;
+    ns_script_schedule();
+}
+
+// Payload length of uplink MAC commands, -1 for unknown commands
+static int8_t ns_mac_command_size(uint8_t cid)
+{
+    switch(cid)
+    {
+        case NS_LINK_CHECK:         // LinkCheckReq
+        case 0x04:                  // DutyCycleAns
+        case 0x08:                  // RXTimingSetupAns
+        case 0x09:                  // TxParamSetupAns
+        case 0x0C:                  // ADRParamSetupAns
+        case NS_DEVICE_TIME:        // DeviceTimeReq
+        case 0x12:                  // BeaconTimingReq
+            return 0;
+        case NS_RESET_IND:
+        case 0x03:                  // LinkADRAns
+        case 0x05:                  // RXParamSetupAns
+        case 0x07:                  // NewChannelAns
+        case 0x0A:                  // DlChannelAns
+        case NS_REKEY_IND:
+        case 0x0F:                  // RejoinParamSetupAns
+        case NS_PING_SLOT_INFO:     // PingSlotInfoReq
+        case 0x11:                  // PingSlotChannelAns
+        case 0x13:                  // BeaconFreqAns
+        case NS_DEVICE_MODE:        // DeviceModeInd
+            return 1;
+        case 0x06:                  // DevStatusAns
+            return 2;
+        default:
+            return -1;
+    }
+}
+
+static void ns_add_answer(const uint8_t *answer, uint8_t size)
+{
+    if(ns_fopts_size + size <= sizeof(ns_fopts))
+    {
+        memcpy(ns_fopts + ns_fopts_size, answer, size);
+        ns_fopts_size += size;
+    }
+}
+
+static void ns_mac_commands(const uint8_t *cmd, uint8_t size, const sim_uplink_t &uplink)
+{
+    uint8_t i = 0;
+
+    while(i < size)
+    {
+        uint8_t cid = cmd[i++];
+        int8_t  len = ns_mac_command_size(cid);
+
+        if((len < 0) || (i + len > size))
+            break;
+
+        switch(cid)
+        {
+            case NS_LINK_CHECK:
+            {
+                int margin = (int)(uplink.link.snr - sim_snr_required(uplink.sf));
+                uint8_t answer[3] = { NS_LINK_CHECK, (uint8_t)((margin < 0) ? 0 : margin), uplink.link.gateways };
+                ns_add_answer(answer, sizeof(answer));
+                break;
+            }
+            case NS_DEVICE_TIME:
+            {
+                uint64_t gps_ms = ns_gps_ms(uplink.end_us);
+                uint8_t answer[6] = { NS_DEVICE_TIME };
+
+                ns_put32(answer + 1, (uint32_t)(gps_ms / 1000));
+                answer[5] = (uint8_t)(((gps_ms % 1000) * 256) / 1000);
+                ns_add_answer(answer, sizeof(answer));
+
+                // A device asking for the time is heading for Class B
+                if(!ns_beacons)
+                {
+                    ns_beacons = true;
+                    ns_queue->call(ns_beacon_event);
+                }
+                break;
+            }
+            case NS_PING_SLOT_INFO:
+            {
+                uint8_t answer[1] = { NS_PING_SLOT_INFO };
+
+                ns_ping_periodicity = cmd[i] & 0x07;
+                ns_ping_slot_info = true;
+                ns_add_answer(answer, sizeof(answer));
+                break;
+            }
+            case NS_RESET_IND:
+            case NS_REKEY_IND:
+            {
+                uint8_t answer[2] = { cid, 1 };
+                ns_add_answer(answer, sizeof(answer));
+                break;
+            }
+            case NS_DEVICE_MODE:
+            {
+                uint8_t answer[2] = { NS_DEVICE_MODE, cmd[i] };
+
+                ns_device_class = (cmd[i] == 2) ? CLASS_C : CLASS_A;
+                ns_add_answer(answer, sizeof(answer));
+                break;
+            }
+        }
+
+        i += len;
+    }
+}
+
+static void ns_uplink(const uint8_t *frame, uint8_t size, const sim_uplink_t &uplink)
+{
+    uint8_t  mtype = frame[0] >> 5;
+    uint8_t  payload[255];
+    uint8_t  b0[16];
+
+    ns_us915 = (uplink.freq >= 902000000) && (uplink.freq <= 928000000);
+
+    if(mtype == 0)
+    {
+        ns_join(frame, size, uplink);
+        return;
+    }
+
+    if(!ns_joined || ((mtype != 2) && (mtype != 4)) || (size < 12) || (ns_get32(frame + 1) != ns_dev_addr))
+        return;
+
+    uint8_t  fctrl = frame[5];
+    uint8_t  fopts_len = fctrl & 0x0f;
+    uint32_t fcnt = (ns_fcnt_up & 0xffff0000) | frame[6] | (frame[7] << 8);
+
+    if(fcnt < ns_fcnt_up)
+        fcnt += 0x10000;
+
+    ns_b0(b0, 0, fcnt, size - 4);
+    if(ns_cmac(ns_nwk_skey, b0, frame, size - 4) != ns_get32(frame + size - 4))
+    {
+        printf("NS: Uplink MIC error, FCnt=%lu\n", fcnt);
+        return;
+    }
+    ns_fcnt_up = fcnt;
+
+    ns_mac_commands(frame + 8, fopts_len, uplink);
+
+    // MAC commands can also be sent as the payload on port 0
+    uint8_t offset = 8 + fopts_len;
+    if((offset < size - 4) && (frame[offset] == 0))
+    {
+        uint8_t len = size - 4 - offset - 1;
+
+        memcpy(payload, frame + offset + 1, len);
+        ns_payload_crypt(ns_nwk_skey, 0, fcnt, payload, len);
+        ns_mac_commands(payload, len, uplink);
+    }
+
+    // Class A downlink in RX1 when there is something to send
+    bool ack = (mtype == 4);
+    bool command = ns_pending_valid && !ns_pending_sent;
+
+    if(ack || command || ns_fopts_size)
+    {
+        uint8_t  frame_out[64];
+        uint8_t  len;
+        uint32_t freq, bandwidth_hz;
+        uint8_t  sf;
+
+        ns_rx1_channel(uplink, freq, sf, bandwidth_hz);
+
+        if(command)
+            len = ns_build_downlink(frame_out, ack, ns_pending.data, ns_pending.size, ns_config_port);
+        else
+            len = ns_build_downlink(frame_out, ack, NULL, 0, 0);
+
+        if(ns_radio->queue_downlink(frame_out, len, freq, sf, bandwidth_hz, uplink.end_us + NS_RX1_DELAY_US, uplink.link.gateway) &&
+           command)
+            ns_pending_queued(uplink.end_us + NS_RX1_DELAY_US);
+    }
+}
+
+static bool ns_atoh(char c, uint8_t &value)
+{
+    if(c >= '0' && c <= '9')
+        value = c - '0';
+    else if(c >= 'a' && c <= 'f')
+        value = c - 'a' + 10;
+    else if(c >= 'A' && c <= 'F')
+        value = c - 'A' + 10;
+    else
+        return false;
+
+    return true;
+}
+
+// "<seconds>:<hex command> ..."
+static void ns_parse_script(const char *script)
+{
+    const char *p = script;
+
+    while(*p && ns_script_count < NS_SCRIPT_MAX)
+    {
+        ns_script_entry_t &entry = ns_script[ns_script_count];
+        uint8_t high, low;
+
+        while(*p == ' ')
+            p++;
+        if(!*p)
+            break;
+
+        entry.at_s = strtoul(p, (char **)&p, 10);
+        entry.size = 0;
+        if(*p++ != ':')
+            break;
+
+        while(ns_atoh(p[0], high) && ns_atoh(p[1], low) && entry.size < NS_COMMAND_MAX)
+        {
+            entry.data[entry.size++] = (high << 4) | low;
+            p += 2;
+        }
+
+        if(entry.size > 0)
+            ns_script_count++;
+    }
+}
+
+void ns_emu_init(SimLoRaRadio *radio, EventQueue *queue, const uint8_t *app_key, uint8_t config_port,
+                 device_class_t device_class, const char *script, uint32_t gps_start_s)
+{
+    ns_radio        = radio;
+    ns_queue        = queue;
+    ns_config_port  = config_port;
+    ns_device_class = device_class;
+    ns_gps_start_ms = (uint64_t)gps_start_s * 1000;
+    memcpy(ns_app_key, app_key, sizeof(ns_app_key));
+    memset(ns_latency, 0, sizeof(ns_latency));
+    ns_parse_script(script);
+
+    radio->attach_network(mbed::callback(ns_uplink));
+}
+
+// The device changed class, as an operator would tell the server
+void ns_emu_set_device_class(device_class_t device_class)
+{
+    ns_device_class = device_class;
+}
+
+// Called by the application when it handles a configuration port command
+void ns_emu_command_received(const uint8_t *buffer, uint8_t size, device_class_t device_class)
+{
+    if(!ns_pending_valid || (size != ns_pending.size) || memcmp(buffer, ns_pending.data, size))
+        return;
+
+    uint32_t latency = (uint32_t)((ns_radio->now_us() - ns_pending_us) / 1000);
+    ns_latency_t &stats = ns_latency[device_class];
+
+    if((stats.count == 0) || (latency < stats.min_ms))
+        stats.min_ms = latency;
+    if(latency > stats.max_ms)
+        stats.max_ms = latency;
+    stats.total_ms += latency;
+    stats.count++;
+
+    ns_pending_valid = false;
+    ns_cancel_retry();
+}
+
+void ns_emu_print_stats()
+{
+    const char *names[] = { "A", "B", "C" };
+
+    printf("NS Session            : %s DevAddr=%08lx FCntUp=%lu FCntDown=%lu\n", ns_joined ? "joined" : "none",
+        ns_dev_addr, ns_fcnt_up, ns_fcnt_down);
+    printf("NS Script             : %u/%u commands, %lu sent, %lu retried, %lu lost\n", ns_script_next, ns_script_count,
+        ns_commands_sent, ns_commands_retried, ns_commands_lost);
+    for(uint8_t i = 0; i < 3; i++)
+    {
+        const ns_latency_t &stats = ns_latency[i];
+
+        printf("NS Class %s Latency    : min=%lu ms max=%lu ms avg=%lu ms count=%lu\n", names[i],
+            stats.min_ms, stats.max_ms, stats.count ? stats.total_ms / stats.count : 0, stats.count);
+    }
+}
+
+#endif // _NS_EMULATOR_HELPER_H
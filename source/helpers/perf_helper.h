@@ -0,0 +1,132 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PERF_HELPER_H
+#define _PERF_HELPER_H
+
+#include "mbed.h"
+
+/**
+ * On-target microbenchmarks of the application hot paths.
+ *
+ * Each benchmark runs a batch of iterations several times and keeps the
+ * fastest batch, which filters out interrupts and queue activity. Time comes
+ * from the DWT cycle counter on Cortex-M3/M4/M7 and from the microsecond
+ * timer elsewhere, so short functions need larger batches on M0+.
+ *
+ * Results are printed as Google Benchmark JSON between PERF-BEGIN and
+ * PERF-END, tools/perf_compare.py extracts them from a serial log and
+ * compares them with a baseline.
+ */
+
+#define PERF_REPETITIONS    5
+#define PERF_VERSION        1
+
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+#define PERF_COUNTER        "cycles"
+#else
+#define PERF_COUNTER        "timer"
+#endif
+
+static Timer    perf_timer;
+static uint32_t perf_count = 0;
+
+void perf_begin(const char *context_name, const char *context_value)
+{
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    perf_timer.start();
+    perf_count = 0;
+
+    printf("PERF-BEGIN\n");
+    printf("{\"context\": {\"version\": %u, \"build\": \"%s %s\", \"mhz_per_cpu\": %lu, "
+        "\"counter\": \"%s\", \"repetitions\": %u, \"%s\": \"%s\"},\n",
+        PERF_VERSION, __DATE__, __TIME__, SystemCoreClock / 1000000, PERF_COUNTER,
+        PERF_REPETITIONS, context_name, context_value);
+    printf(" \"benchmarks\": [\n");
+}
+
+static uint32_t perf_now()
+{
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    return DWT->CYCCNT;
+#else
+    return perf_timer.read_us();
+#endif
+}
+
+static uint32_t perf_to_ns(uint32_t ticks, uint32_t iterations)
+{
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+    return (uint32_t)(((uint64_t)ticks * 1000000000 / SystemCoreClock) / iterations);
+#else
+    return (uint32_t)((uint64_t)ticks * 1000 / iterations);
+#endif
+}
+
+static void perf_print(const char *name, uint32_t iterations, uint32_t best_ns, uint32_t mean_ns)
+{
+    printf("%s  {\"name\": \"%s\", \"run_type\": \"iteration\", \"iterations\": %lu, "
+        "\"real_time\": %lu, \"cpu_time\": %lu, \"mean_time\": %lu, \"time_unit\": \"ns\"}",
+        perf_count ? ",\n" : "", name, iterations, best_ns, best_ns, mean_ns);
+    perf_count++;
+}
+
+// Run fn iterations times per repetition, reports the fastest repetition per iteration
+template<typename F>
+void perf_run(const char *name, uint32_t iterations, F fn)
+{
+    uint32_t best = 0xffffffff;
+    uint64_t total = 0;
+
+    for(uint8_t rep = 0; rep < PERF_REPETITIONS; rep++)
+    {
+        uint32_t start = perf_now();
+
+        for(uint32_t i = 0; i < iterations; i++)
+            fn();
+
+        uint32_t ticks = perf_now() - start;
+        total += ticks;
+        if(ticks < best)
+            best = ticks;
+    }
+
+    perf_print(name, iterations, perf_to_ns(best, iterations),
+        perf_to_ns((uint32_t)(total / PERF_REPETITIONS), iterations));
+}
+
+// Report a duration measured elsewhere, e.g. a boot milestone
+void perf_report_ms(const char *name, uint32_t ms)
+{
+    printf("%s  {\"name\": \"%s\", \"run_type\": \"milestone\", \"iterations\": 1, "
+        "\"real_time\": %lu, \"cpu_time\": %lu, \"time_unit\": \"ms\"}",
+        perf_count ? ",\n" : "", name, ms, ms);
+    perf_count++;
+}
+
+void perf_end()
+{
+    printf("\n ]}\n");
+    printf("PERF-END\n");
+    perf_timer.stop();
+}
+
+#endif // _PERF_HELPER_H
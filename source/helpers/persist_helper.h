@@ -0,0 +1,202 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PERSIST_HELPER_H
+#define _PERSIST_HELPER_H
+
+#include "mbed.h"
+#include "kvstore_global_api.h"
+#include "KVMap.h"
+#include "KVStore.h"
+
+/**
+ * Application settings in KVStore with flash write accounting.
+ *
+ * Every key read at boot or written since is tracked with a copy of its
+ * stored value, a write of the same value is skipped. Per key the writes,
+ * skipped writes, value bytes and estimated flash bytes are counted.
+ *
+ * The flash estimate follows TDBStore: each write appends a record with a
+ * 24 byte header, the key without the partition and the value, padded to
+ * the program size. Write amplification is flash bytes over value bytes.
+ * TDBStore erases one of its two areas each time the other fills up, so
+ * erases are estimated as flash bytes over half the block device.
+ *
+ * Settings are at most 4 bytes, stored in the native byte order.
+ */
+
+#define PERSIST_KEYS_MAX        12
+#define PERSIST_VALUE_MAX       4
+#define PERSIST_RECORD_HEADER   24
+#define PERSIST_PARTITION       "kv"
+
+typedef struct {
+    const char *key;
+    uint8_t     value[PERSIST_VALUE_MAX];
+    uint8_t     size;           // 0 when the key is not stored
+    uint32_t    writes;
+    uint32_t    skipped;
+    uint32_t    value_bytes;
+    uint32_t    flash_bytes;
+} persist_key_t;
+
+static persist_key_t persist_keys[PERSIST_KEYS_MAX];
+static uint8_t       persist_key_count = 0;
+static uint32_t      persist_resets = 0;
+
+static persist_key_t *persist_find(const char *key)
+{
+    for(uint8_t i = 0; i < persist_key_count; i++)
+    {
+        if(strcmp(persist_keys[i].key, key) == 0)
+            return &persist_keys[i];
+    }
+
+    if(persist_key_count == PERSIST_KEYS_MAX)
+        return NULL;
+
+    persist_key_t *entry = &persist_keys[persist_key_count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->key = key;
+    return entry;
+}
+
+static BlockDevice *persist_block_device()
+{
+    return KVMap::get_instance().get_internal_blockdevice_instance(PERSIST_PARTITION);
+}
+
+static uint32_t persist_record_size(const char *key, uint8_t size)
+{
+    BlockDevice *bd = persist_block_device();
+    uint32_t program_size = bd ? bd->get_program_size() : 1;
+    const char *name = strrchr(key, '/');
+    uint32_t bytes = PERSIST_RECORD_HEADER + strlen(name ? name + 1 : key) + size;
+
+    return ((bytes + program_size - 1) / program_size) * program_size;
+}
+
+// Read a setting into value (zero extended), false when it is not stored or invalid.
+// Without a store the KVStore of the application is read and the value is kept
+// for persist_write(), a given store (e.g. for benchmarks) is only read.
+bool persist_restore(const char *key, uint32_t &value, KVStore *store = NULL)
+{
+    persist_key_t *entry = store ? NULL : persist_find(key);
+    uint8_t buffer[PERSIST_VALUE_MAX];
+    size_t actual_size = 0;
+    int rc;
+
+    value = 0;
+    if(store)
+    {
+        const char *name = strrchr(key, '/');
+        rc = store->get(name ? name + 1 : key, buffer, sizeof(buffer), &actual_size);
+    }
+    else
+    {
+        rc = kv_get(key, buffer, sizeof(buffer), &actual_size);
+    }
+    if((rc != MBED_SUCCESS) || (actual_size == 0) || (actual_size > sizeof(buffer)))
+        return false;
+
+    memcpy(&value, buffer, actual_size);
+    if(entry)
+    {
+        memcpy(entry->value, buffer, actual_size);
+        entry->size = actual_size;
+    }
+
+    return true;
+}
+
+// Write a setting unless the store already holds this value
+int persist_write(const char *key, const void *value, uint8_t size)
+{
+    persist_key_t *entry = persist_find(key);
+
+    MBED_ASSERT(size <= PERSIST_VALUE_MAX);
+
+    if(entry && (entry->size == size) && (memcmp(entry->value, value, size) == 0))
+    {
+        entry->skipped++;
+        return MBED_SUCCESS;
+    }
+
+    int rc = kv_set(key, value, size, 0);
+    if((rc == MBED_SUCCESS) && entry)
+    {
+        memcpy(entry->value, value, size);
+        entry->size = size;
+        entry->writes++;
+        entry->value_bytes += size;
+        entry->flash_bytes += persist_record_size(key, size);
+    }
+
+    return rc;
+}
+
+// Remove the application settings, other keys (traces, post-mortem) stay
+int persist_reset()
+{
+    int result = MBED_SUCCESS;
+
+    for(uint8_t i = 0; i < persist_key_count; i++)
+    {
+        persist_key_t &entry = persist_keys[i];
+        int rc = kv_remove(entry.key);
+
+        if((rc != MBED_SUCCESS) && (rc != MBED_ERROR_ITEM_NOT_FOUND))
+            result = rc;
+
+        // A removal appends a deletion record
+        if(rc == MBED_SUCCESS)
+            entry.flash_bytes += persist_record_size(entry.key, 0);
+        entry.size = 0;
+    }
+    persist_resets++;
+
+    return result;
+}
+
+void persist_print_stats()
+{
+    BlockDevice *bd = persist_block_device();
+    uint32_t writes = 0, skipped = 0, value_bytes = 0, flash_bytes = 0;
+
+    printf("%-22s %7s %7s %7s %7s %5s\n", "Key", "writes", "skipped", "bytes", "flash", "WA");
+    for(uint8_t i = 0; i < persist_key_count; i++)
+    {
+        const persist_key_t &entry = persist_keys[i];
+
+        printf("%-22s %7lu %7lu %7lu %7lu %5lu\n", entry.key, entry.writes, entry.skipped,
+            entry.value_bytes, entry.flash_bytes, entry.value_bytes ? entry.flash_bytes / entry.value_bytes : 0);
+        writes      += entry.writes;
+        skipped     += entry.skipped;
+        value_bytes += entry.value_bytes;
+        flash_bytes += entry.flash_bytes;
+    }
+    printf("%-22s %7lu %7lu %7lu %7lu %5lu\n", "total", writes, skipped, value_bytes, flash_bytes,
+        value_bytes ? flash_bytes / value_bytes : 0);
+
+    if(bd && (bd->size() >= 2))
+        printf("Estimated erases       : %lu of %lu byte areas, %lu resets\n",
+            (uint32_t)(flash_bytes / (bd->size() / 2)), (uint32_t)(bd->size() / 2), persist_resets);
+    else
+        printf("Estimated erases       : unknown, %lu resets\n", persist_resets);
+}
+
+#endif // _PERSIST_HELPER_H
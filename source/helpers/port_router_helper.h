@@ -0,0 +1,102 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _PORT_ROUTER_HELPER_H
+#define _PORT_ROUTER_HELPER_H
+
+#include "mbed.h"
+#include "lorawan_types.h"
+
+/**
+ * Downlink dispatch by FPort.
+ *
+ * Handlers register for a port and for unicast and/or multicast downlinks,
+ * and get a view of the receive buffer. The buffer is only valid for the
+ * duration of the call, handlers that defer work must copy what they need.
+ */
+
+#define PORT_ROUTER_MAX_ROUTES      8
+
+// Accepted downlink types
+#define PORT_ROUTE_UNICAST          0x01
+#define PORT_ROUTE_MULTICAST        0x02
+#define PORT_ROUTE_ANY              (PORT_ROUTE_UNICAST | PORT_ROUTE_MULTICAST)
+
+typedef mbed::Callback<void(const uint8_t *buffer, uint8_t size, uint8_t port, int flags)> port_handler_t;
+
+typedef struct {
+    uint8_t        port;
+    uint8_t        accept;
+    uint32_t       count;
+    port_handler_t handler;
+} port_route_t;
+
+static port_route_t port_routes[PORT_ROUTER_MAX_ROUTES];
+static uint8_t      port_route_count  = 0;
+static uint32_t     port_unrouted     = 0;
+
+bool port_router_register(uint8_t port, uint8_t accept, port_handler_t handler)
+{
+    if(port_route_count == PORT_ROUTER_MAX_ROUTES)
+        return false;
+
+    port_routes[port_route_count].port    = port;
+    port_routes[port_route_count].accept  = accept;
+    port_routes[port_route_count].count   = 0;
+    port_routes[port_route_count].handler = handler;
+    port_route_count++;
+
+    return true;
+}
+
+// Returns false if no handler accepted the downlink
+bool port_router_dispatch(const uint8_t *buffer, uint8_t size, uint8_t port, int flags)
+{
+    uint8_t type    = (flags & MSG_MULTICAST_FLAG) ? PORT_ROUTE_MULTICAST : PORT_ROUTE_UNICAST;
+    bool    handled = false;
+
+    for(uint8_t i = 0; i < port_route_count; i++)
+    {
+        port_route_t &route = port_routes[i];
+
+        if((route.port == port) && (route.accept & type))
+        {
+            route.count++;
+            route.handler(buffer, size, port, flags);
+            handled = true;
+        }
+    }
+
+    if(!handled)
+        port_unrouted++;
+
+    return handled;
+}
+
+void port_router_print_stats()
+{
+    for(uint8_t i = 0; i < port_route_count; i++)
+    {
+        printf("FPort %-3u %s%s : %lu\n", port_routes[i].port,
+            (port_routes[i].accept & PORT_ROUTE_UNICAST) ? "U" : "-",
+            (port_routes[i].accept & PORT_ROUTE_MULTICAST) ? "M" : "-",
+            port_routes[i].count);
+    }
+    printf("Unrouted Downlinks    : %lu\n", port_unrouted);
+}
+
+#endif // _PORT_ROUTER_HELPER_H
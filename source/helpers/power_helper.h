@@ -0,0 +1,158 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _POWER_HELPER_H
+#define _POWER_HELPER_H
+
+#include "mbed.h"
+#include "mbed_stats.h"
+
+/**
+ * Time-in-sleep accounting and deep sleep lock audit.
+ *
+ * Sleep counters come from the Mbed CPU statistics, enable them with
+ * platform.cpu-stats-enabled (the low-power builds do). Call
+ * power_cycle_mark() once per uplink cycle, the active/sleep/deep sleep
+ * split of the last cycle is printed by power_print_stats().
+ *
+ * The sleep manager does not tell who holds a deep sleep lock, so the
+ * application registers the lock holders it knows of with a function telling
+ * whether each currently holds one. power_audit_sample() runs from a periodic
+ * event, between the radio and console activity, and counts per holder the
+ * samples where deep sleep was locked. A locked sample no registered holder
+ * explains is counted as unknown, MBED_SLEEP_TRACING_ENABLED then lists the
+ * owners by file.
+ */
+
+#define POWER_AUDIT_MAX_HOLDERS 4
+
+typedef struct {
+    uint64_t active_us;
+    uint64_t sleep_us;
+    uint64_t deep_sleep_us;
+} power_times_t;
+
+typedef struct {
+    const char *name;
+    bool      (*holding)();
+    uint32_t    locked;
+} power_holder_t;
+
+static power_times_t  power_cycle_start;
+static power_times_t  power_last_cycle;
+static uint32_t       power_cycle_count          = 0;
+static power_holder_t power_holders[POWER_AUDIT_MAX_HOLDERS];
+static uint8_t        power_holder_count         = 0;
+static uint32_t       power_audit_samples        = 0;
+static uint32_t       power_audit_locked         = 0;
+static uint32_t       power_audit_unknown        = 0;
+
+void power_get_times(power_times_t &times)
+{
+#if MBED_CPU_STATS_ENABLED
+    mbed_stats_cpu_t stats;
+    mbed_stats_cpu_get(&stats);
+
+    times.sleep_us      = stats.sleep_time;
+    times.deep_sleep_us = stats.deep_sleep_time;
+    times.active_us     = stats.uptime - stats.sleep_time - stats.deep_sleep_time;
+#else
+    memset(&times, 0, sizeof(times));
+#endif
+}
+
+// holding() is called from the audit event, it only reads state
+void power_audit_register(const char *name, bool (*holding)())
+{
+    if(power_holder_count == POWER_AUDIT_MAX_HOLDERS)
+    {
+        printf("Deep sleep audit full, %s not registered\n", name);
+        return;
+    }
+
+    power_holders[power_holder_count].name    = name;
+    power_holders[power_holder_count].holding = holding;
+    power_holders[power_holder_count].locked  = 0;
+    power_holder_count++;
+}
+
+void power_audit_sample()
+{
+    bool known = false;
+
+    power_audit_samples++;
+    if(sleep_manager_can_deep_sleep())
+        return;
+
+    power_audit_locked++;
+    for(uint8_t i = 0; i < power_holder_count; i++)
+    {
+        if(power_holders[i].holding())
+        {
+            power_holders[i].locked++;
+            known = true;
+        }
+    }
+
+    if(!known)
+        power_audit_unknown++;
+}
+
+// Call once per uplink cycle, keeps the times of the cycle for power_print_stats()
+void power_cycle_mark()
+{
+    power_times_t now;
+
+    power_get_times(now);
+    power_cycle_count++;
+
+    power_last_cycle.active_us     = now.active_us - power_cycle_start.active_us;
+    power_last_cycle.sleep_us      = now.sleep_us - power_cycle_start.sleep_us;
+    power_last_cycle.deep_sleep_us = now.deep_sleep_us - power_cycle_start.deep_sleep_us;
+
+    power_cycle_start = now;
+}
+
+void power_print_stats(bool console_attached)
+{
+#if MBED_CPU_STATS_ENABLED
+    power_times_t now;
+
+    power_get_times(now);
+
+    printf("Active Time           : %lu ms\n", (uint32_t)(now.active_us / 1000));
+    printf("Sleep Time            : %lu ms\n", (uint32_t)(now.sleep_us / 1000));
+    printf("Deep Sleep Time       : %lu ms\n", (uint32_t)(now.deep_sleep_us / 1000));
+#else
+    printf("CPU statistics disabled (platform.cpu-stats-enabled)\n");
+#endif
+    printf("Uplink Cycles         : %lu\n", power_cycle_count);
+#if MBED_CPU_STATS_ENABLED
+    printf("Last Cycle            : active=%lu ms, sleep=%lu ms, deep sleep=%lu ms\n",
+        (uint32_t)(power_last_cycle.active_us / 1000),
+        (uint32_t)(power_last_cycle.sleep_us / 1000),
+        (uint32_t)(power_last_cycle.deep_sleep_us / 1000));
+#endif
+    printf("Deep Sleep            : %s\n", sleep_manager_can_deep_sleep() ? "allowed" : "locked");
+    printf("Deep Sleep Locked     : %lu of %lu samples\n", power_audit_locked, power_audit_samples);
+    for(uint8_t i = 0; i < power_holder_count; i++)
+        printf("  %-20s: %lu samples\n", power_holders[i].name, power_holders[i].locked);
+    printf("  %-20s: %lu samples\n", "unknown", power_audit_unknown);
+    printf("Console               : %s\n", console_attached ? "attached (holds deep sleep lock)" : "released");
+}
+
+#endif // _POWER_HELPER_H
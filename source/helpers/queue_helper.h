@@ -0,0 +1,137 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _QUEUE_HELPER_H
+#define _QUEUE_HELPER_H
+
+#include "mbed.h"
+#include "mbed_events.h"
+#include "platform/mbed_atomic.h"
+
+/**
+ * Helpers for the radio and console event queues.
+ *
+ * SpscMailbox passes messages from one producer context to one consumer
+ * context without locks, the indices are only written by their owner side.
+ * The consumer is usually notified by posting a drain event to its queue, the
+ * message itself never goes through the queue allocator.
+ *
+ * The latency probe is a periodic event on a queue, it records how late the
+ * event is dispatched compared to its schedule. A probe being late means an
+ * other event on the same queue (or a higher priority thread) held it up.
+ */
+
+template<typename T, uint32_t N>
+class SpscMailbox {
+    MBED_STATIC_ASSERT((N & (N - 1)) == 0, "SpscMailbox size must be a power of two");
+
+public:
+    SpscMailbox() : _head(0), _tail(0), _dropped(0) {}
+
+    // Producer side, returns false when the mailbox is full
+    bool put(const T &item)
+    {
+        uint32_t head = _head;
+
+        if(head - core_util_atomic_load_u32(&_tail) >= N)
+        {
+            _dropped++;
+            return false;
+        }
+
+        _items[head % N] = item;
+        core_util_atomic_store_u32(&_head, head + 1);
+        return true;
+    }
+
+    // Consumer side, returns false when the mailbox is empty
+    bool get(T &item)
+    {
+        uint32_t tail = _tail;
+
+        if(tail == core_util_atomic_load_u32(&_head))
+            return false;
+
+        item = _items[tail % N];
+        core_util_atomic_store_u32(&_tail, tail + 1);
+        return true;
+    }
+
+    // Messages waiting, safe to read from any context
+    uint32_t count() const
+    {
+        return core_util_atomic_load_u32(&_head) - core_util_atomic_load_u32(&_tail);
+    }
+
+    uint32_t dropped() const
+    {
+        return _dropped;
+    }
+
+private:
+    T                 _items[N];
+    volatile uint32_t _head;
+    volatile uint32_t _tail;
+    uint32_t          _dropped;
+};
+
+typedef struct {
+    const char *name;
+    EventQueue *queue;
+    int         expected;   // Queue tick the next probe is scheduled for
+    int         interval;
+    uint32_t    count;
+    uint32_t    max_ms;
+    uint32_t    total_ms;
+} queue_probe_t;
+
+static void queue_probe_event(queue_probe_t *probe)
+{
+    int late = probe->queue->tick() - probe->expected;
+
+    if(late < 0)
+        late = 0;
+
+    probe->expected += probe->interval;
+    probe->count++;
+    probe->total_ms += late;
+    if((uint32_t)late > probe->max_ms)
+        probe->max_ms = late;
+}
+
+// Periodic events are scheduled against their previous target, so lateness does not accumulate
+void queue_probe_start(queue_probe_t *probe, const char *name, EventQueue *queue, int interval_ms)
+{
+    memset(probe, 0, sizeof(*probe));
+    probe->name     = name;
+    probe->queue    = queue;
+    probe->interval = interval_ms;
+
+    if(interval_ms <= 0)
+        return;
+
+    probe->expected = queue->tick() + interval_ms;
+    queue->call_every(interval_ms, queue_probe_event, probe);
+}
+
+void queue_probe_print(const queue_probe_t *probe)
+{
+    printf("%-8s latency avg=%lu ms max=%lu ms probes=%lu\n", probe->name,
+        probe->count ? probe->total_ms / probe->count : 0, probe->max_ms, probe->count);
+}
+
+#endif // _QUEUE_HELPER_H
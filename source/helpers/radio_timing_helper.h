@@ -0,0 +1,150 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _RADIO_TIMING_HELPER_H
+#define _RADIO_TIMING_HELPER_H
+
+#include "mbed.h"
+#include "lorawan/LoRaRadio.h"
+
+/**
+ * Receive window timing of a radio driver.
+ *
+ * RadioTiming wraps the driver selected in lora_radio_helper.h and measures
+ * the time from the TX done interrupt, as reported by the driver through
+ * radio_events_t::tx_done, to the MAC opening the first and second receive
+ * windows with receive(). The spread between min and max is the scheduling
+ * latency added by the MAC timers, the event queue and the driver.
+ *
+ * A receive() is counted as RX1 or RX2 by its delay after TX done, within
+ * RADIO_TIMING_TOLERANCE_MS of the RX1 delay or one second later (LoRaWAN
+ * RECEIVE_DELAY1 and JOIN_ACCEPT_DELAY1). Each window counts at most once
+ * per uplink. Other receptions, the Class C continuous RX2 opened right after
+ * TX, beacons and ping slots, are not counted. A network changing the RX1
+ * delay with RXTimingSetupReq moves the windows out of the classification.
+ *
+ * A LowPowerTimer is used so the measurement does not hold a deep sleep lock,
+ * its resolution is one low power ticker tick (about 30 us on LPTIM targets).
+ */
+
+#define RADIO_TIMING_WINDOWS        2
+#define RADIO_TIMING_RX1_DELAY_MS   1000
+#define RADIO_TIMING_JOIN_DELAY_MS  5000
+#define RADIO_TIMING_RX2_OFFSET_MS  1000
+#define RADIO_TIMING_TOLERANCE_MS   500
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+} radio_timing_stats_t;
+
+template<typename Radio>
+class RadioTiming final : public Radio {
+public:
+    template<typename... Args>
+    RadioTiming(Args... args) : Radio(args...), _app_events(NULL), _tx_done_us(0), _counted((1 << RADIO_TIMING_WINDOWS) - 1)
+    {
+        memset(_stats, 0, sizeof(_stats));
+        _timer.start();
+    }
+
+    virtual void init_radio(radio_events_t *events)
+    {
+        // Forward every event as is, only tx_done is intercepted
+        _app_events     = events;
+        _events         = *events;
+        _events.tx_done = mbed::callback(this, &RadioTiming::tx_done);
+
+        Radio::init_radio(&_events);
+    }
+
+    virtual void receive(void)
+    {
+        uint32_t delay = (uint32_t)(_timer.read_high_resolution_us() - _tx_done_us);
+        int8_t   window = classify(delay);
+
+        if((window >= 0) && !(_counted & (1 << window)))
+        {
+            radio_timing_stats_t &stats = _stats[window];
+
+            _counted |= 1 << window;
+            if((stats.count == 0) || (delay < stats.min_us))
+                stats.min_us = delay;
+            if(delay > stats.max_us)
+                stats.max_us = delay;
+            stats.total_us += delay;
+            stats.count++;
+        }
+
+        Radio::receive();
+    }
+
+    void print_stats()
+    {
+        for(uint8_t i = 0; i < RADIO_TIMING_WINDOWS; i++)
+        {
+            const radio_timing_stats_t &stats = _stats[i];
+
+            printf("TxDone -> RX%u open : min=%lu us max=%lu us avg=%lu us count=%lu\n", i + 1,
+                stats.min_us, stats.max_us, stats.count ? (uint32_t)(stats.total_us / stats.count) : 0, stats.count);
+        }
+    }
+
+private:
+    static bool near(uint32_t delay_us, uint32_t window_ms)
+    {
+        uint32_t delay_ms = delay_us / 1000;
+
+        return (delay_ms + RADIO_TIMING_TOLERANCE_MS >= window_ms) && (delay_ms <= window_ms + RADIO_TIMING_TOLERANCE_MS);
+    }
+
+    // Receive window by its delay after TX done, -1 for anything else
+    static int8_t classify(uint32_t delay_us)
+    {
+        static const uint32_t rx1_delays_ms[] = { RADIO_TIMING_RX1_DELAY_MS, RADIO_TIMING_JOIN_DELAY_MS };
+
+        for(uint8_t i = 0; i < sizeof(rx1_delays_ms) / sizeof(rx1_delays_ms[0]); i++)
+        {
+            if(near(delay_us, rx1_delays_ms[i]))
+                return 0;
+            if(near(delay_us, rx1_delays_ms[i] + RADIO_TIMING_RX2_OFFSET_MS))
+                return 1;
+        }
+
+        return -1;
+    }
+
+    void tx_done()
+    {
+        _tx_done_us = _timer.read_high_resolution_us();
+        _counted    = 0;
+
+        if(_app_events && _app_events->tx_done)
+            _app_events->tx_done();
+    }
+
+    radio_events_t      *_app_events;
+    radio_events_t       _events;
+    LowPowerTimer        _timer;
+    uint64_t             _tx_done_us;
+    uint8_t              _counted;      // Windows counted since the last TX done, bit per window
+    radio_timing_stats_t _stats[RADIO_TIMING_WINDOWS];
+};
+
+#endif // _RADIO_TIMING_HELPER_H
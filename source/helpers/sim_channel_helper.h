@@ -0,0 +1,271 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SIM_CHANNEL_HELPER_H
+#define _SIM_CHANNEL_HELPER_H
+
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * LoRa channel model used by the simulated radio.
+ *
+ * - Log-distance path loss with log-normal shadowing, defaults from the Oulu
+ *   measurements (128.95 dB at 1 km, exponent 2.32, sigma 7.8 dB).
+ * - A packet is demodulated when its SNR is above the SF dependent threshold.
+ * - Other devices of the network are background traffic, a Poisson process
+ *   per channel placed uniformly over the area. An overlapping packet on the
+ *   same SF destroys ours unless ours is SIM_CAPTURE_DB stronger (capture
+ *   effect). Other SFs only interfere when SIM_SF_ISOLATION_DB stronger.
+ * - Gateways sit on a square grid, a packet is received when any gateway
+ *   gets it. Downlinks are sent by the gateway that heard the uplink best.
+ *
+ * tools/lora_network_sim.py implements the same model for whole networks in
+ * Python, reading the constants from this file. It simulates every device
+ * instead of the Poisson background used here.
+ */
+
+#define SIM_GATEWAYS_MAX        16
+
+#ifndef SIM_PATH_LOSS_1KM_DB
+#define SIM_PATH_LOSS_1KM_DB    128.95f
+#endif
+#ifndef SIM_PATH_LOSS_EXPONENT
+#define SIM_PATH_LOSS_EXPONENT  2.32f
+#endif
+#ifndef SIM_SHADOWING_DB
+#define SIM_SHADOWING_DB        7.8f
+#endif
+#define SIM_NOISE_FIGURE_DB     6.0f
+#define SIM_CAPTURE_DB          6.0f
+#define SIM_SF_ISOLATION_DB     16.0f
+#define SIM_DEVICE_TX_POWER_DBM 14.0f
+#define SIM_GW_TX_POWER_DBM     27.0f
+
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+} sim_point_t;
+
+typedef struct {
+    float   rssi;               // Best gateway
+    float   snr;
+    int8_t  gateway;            // Best gateway, -1 when not received
+    uint8_t gateways;           // Number of gateways that received the packet
+    uint8_t collisions;         // Overlapping background packets
+} sim_link_t;
+
+typedef struct {
+    uint8_t     gateways;
+    uint16_t    gateway_spacing_m;
+    sim_point_t device;
+    uint32_t    background_devices;
+    uint32_t    background_interval_s;
+    uint16_t    area_radius_m;
+    uint8_t     channels;
+} sim_channel_config_t;
+
+static sim_channel_config_t sim_config;
+static sim_point_t          sim_gateway[SIM_GATEWAYS_MAX];
+static uint32_t             sim_rng_state = 1;
+
+// SNR demodulation thresholds, SF7 to SF12
+static const float sim_snr_threshold[] = { -7.5f, -10.0f, -12.5f, -15.0f, -17.5f, -20.0f };
+
+uint32_t sim_random()
+{
+    // xorshift32
+    sim_rng_state ^= sim_rng_state << 13;
+    sim_rng_state ^= sim_rng_state >> 17;
+    sim_rng_state ^= sim_rng_state << 5;
+    return sim_rng_state;
+}
+
+// Uniform in (0, 1]
+static float sim_uniform()
+{
+    return ((sim_random() >> 8) + 1) / 16777216.0f;
+}
+
+static float sim_gauss(float sigma)
+{
+    // Box-Muller
+    return sigma * sqrtf(-2.0f * logf(sim_uniform())) * cosf(6.2831853f * sim_uniform());
+}
+
+static uint32_t sim_poisson(float mean)
+{
+    float limit = expf(-mean);
+    float p = sim_uniform();
+    uint32_t k = 0;
+
+    while(p > limit)
+    {
+        p *= sim_uniform();
+        k++;
+    }
+
+    return k;
+}
+
+float sim_path_loss_db(float distance_m)
+{
+    if(distance_m < 1.0f)
+        distance_m = 1.0f;
+
+    return SIM_PATH_LOSS_1KM_DB + 10.0f * SIM_PATH_LOSS_EXPONENT * log10f(distance_m / 1000.0f);
+}
+
+float sim_noise_floor_dbm(uint32_t bandwidth_hz)
+{
+    return -174.0f + 10.0f * log10f((float)bandwidth_hz) + SIM_NOISE_FIGURE_DB;
+}
+
+static float sim_snr_required(uint8_t sf)
+{
+    return sim_snr_threshold[((sf < 7) ? 7 : (sf > 12) ? 12 : sf) - 7];
+}
+
+static float sim_distance(sim_point_t a, float x, float y)
+{
+    float dx = a.x - x;
+    float dy = a.y - y;
+
+    return sqrtf(dx * dx + dy * dy);
+}
+
+void sim_channel_init(const sim_channel_config_t &config, uint32_t seed)
+{
+    uint8_t side = 1;
+
+    sim_config = config;
+    if(sim_config.gateways > SIM_GATEWAYS_MAX)
+        sim_config.gateways = SIM_GATEWAYS_MAX;
+    if(sim_config.channels == 0)
+        sim_config.channels = 1;
+
+    while(side * side < sim_config.gateways)
+        side++;
+
+    for(uint8_t i = 0; i < sim_config.gateways; i++)
+    {
+        sim_gateway[i].x = (i % side) * sim_config.gateway_spacing_m;
+        sim_gateway[i].y = (i / side) * sim_config.gateway_spacing_m;
+    }
+
+    sim_rng_state = seed ? seed : 1;
+}
+
+// True when a background packet overlapping ours at the gateway destroys it
+static bool sim_interferer_wins(uint8_t gw, float rssi, uint8_t sf, uint32_t bandwidth_hz)
+{
+    float r     = sim_config.area_radius_m * sqrtf(sim_uniform());
+    float angle = 6.2831853f * sim_uniform();
+    float x     = sim_gateway[gw].x + r * cosf(angle);
+    float y     = sim_gateway[gw].y + r * sinf(angle);
+    float other = SIM_DEVICE_TX_POWER_DBM - sim_path_loss_db(sim_distance(sim_gateway[gw], x, y)) + sim_gauss(SIM_SHADOWING_DB);
+    float snr   = other - sim_noise_floor_dbm(bandwidth_hz);
+    uint8_t other_sf = 7;
+
+    // Background devices use the lowest SF that closes their link
+    while(other_sf < 12 && snr < sim_snr_required(other_sf))
+        other_sf++;
+
+    if(other_sf == sf)
+        return rssi - other < SIM_CAPTURE_DB;
+
+    return other - rssi > SIM_SF_ISOLATION_DB;
+}
+
+sim_link_t sim_channel_uplink(uint8_t sf, uint32_t bandwidth_hz, float power_dbm, uint32_t time_on_air_us)
+{
+    sim_link_t link = { -200.0f, -100.0f, -1, 0, 0 };
+    float noise = sim_noise_floor_dbm(bandwidth_hz);
+
+    // Packets starting up to one airtime before or after ours overlap it
+    float rate = (float)sim_config.background_devices / sim_config.background_interval_s / sim_config.channels;
+    float mean = rate * 2.0f * time_on_air_us / 1000000.0f;
+
+    for(uint8_t gw = 0; gw < sim_config.gateways; gw++)
+    {
+        float rssi = power_dbm - sim_path_loss_db(sim_distance(sim_gateway[gw], sim_config.device.x, sim_config.device.y)) + sim_gauss(SIM_SHADOWING_DB);
+        float snr  = rssi - noise;
+        uint32_t overlapping = sim_poisson(mean);
+        bool lost = snr < sim_snr_required(sf);
+
+        if(overlapping > link.collisions)
+            link.collisions = (overlapping > 255) ? 255 : overlapping;
+
+        for(uint32_t i = 0; i < overlapping && !lost; i++)
+            lost = sim_interferer_wins(gw, rssi, sf, bandwidth_hz);
+
+        if(lost)
+            continue;
+
+        link.gateways++;
+        if(snr > link.snr)
+        {
+            link.rssi    = rssi;
+            link.snr     = snr;
+            link.gateway = gw;
+        }
+    }
+
+    return link;
+}
+
+// Downlinks from a gateway, collisions at the device are not modeled
+sim_link_t sim_channel_downlink(int8_t gateway, uint8_t sf, uint32_t bandwidth_hz)
+{
+    sim_link_t link = { -200.0f, -100.0f, -1, 0, 0 };
+
+    if((gateway < 0) || (gateway >= sim_config.gateways))
+        gateway = 0;
+
+    link.rssi = SIM_GW_TX_POWER_DBM - sim_path_loss_db(sim_distance(sim_gateway[gateway], sim_config.device.x, sim_config.device.y)) + sim_gauss(SIM_SHADOWING_DB);
+    link.snr  = link.rssi - sim_noise_floor_dbm(bandwidth_hz);
+    if(link.snr >= sim_snr_required(sf))
+    {
+        link.gateway  = gateway;
+        link.gateways = 1;
+    }
+
+    return link;
+}
+
+// LoRa packet duration, bandwidth in Hz and coding rate 1 (4/5) to 4 (4/8)
+uint32_t sim_time_on_air_us(uint8_t sf, uint32_t bandwidth_hz, uint8_t coderate, uint16_t preamble_len, uint8_t size, bool crc_on)
+{
+    uint32_t symbol_us = (uint32_t)(((uint64_t)1000000 << sf) / bandwidth_hz);
+    int32_t  de = (symbol_us >= 16000) ? 1 : 0;
+    int32_t  bits = 8 * size - 4 * sf + 28 + (crc_on ? 16 : 0);
+    int32_t  per_block = 4 * (sf - 2 * de);
+    int32_t  blocks = (bits > 0) ? (bits + per_block - 1) / per_block : 0;
+    uint32_t symbols = 8 + blocks * (coderate + 4);
+
+    return ((preamble_len * 4 + 17) * symbol_us) / 4 + symbols * symbol_us;
+}
+
+// Fraction of time a channel is busy with background traffic
+float sim_channel_occupancy(uint32_t time_on_air_us)
+{
+    float rate = (float)sim_config.background_devices / sim_config.background_interval_s / sim_config.channels;
+
+    return rate * time_on_air_us / 1000000.0f;
+}
+
+#endif // _SIM_CHANNEL_HELPER_H
@@ -0,0 +1,439 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SIM_RADIO_HELPER_H
+#define _SIM_RADIO_HELPER_H
+
+#include "mbed.h"
+#include "lorawan/LoRaRadio.h"
+#include "sim_channel_helper.h"
+
+/**
+ * Simulated LoRa radio.
+ *
+ * Implements LoRaRadio on top of the channel model in sim_channel_helper.h,
+ * so the LoRaWAN stack and the application run unchanged on a board without
+ * a radio. Packet durations follow the LoRa time on air, TX done, RX done and
+ * RX timeout are raised from a Timeout like the DIO interrupts of a real
+ * driver.
+ *
+ * Uplinks heard by at least one gateway are handed to the attached network
+ * callback when they are sent. The network answers with queue_downlink(),
+ * giving the time the downlink starts on air. A receive window gets the
+ * downlink when frequency and SF match and the window opens before the
+ * preamble is over, the downlink itself can still be lost on the way.
+ */
+
+#define SIM_DOWNLINK_QUEUE      4
+#define SIM_PREAMBLE_LOCK_SYMS  5       // Preamble symbols needed to detect a packet
+
+typedef struct {
+    uint32_t   freq;
+    uint8_t    sf;
+    uint32_t   bandwidth_hz;
+    uint64_t   end_us;          // Simulation time the uplink is over
+    sim_link_t link;
+} sim_uplink_t;
+
+typedef struct {
+    bool     used;
+    uint8_t  size;
+    int8_t   gateway;
+    uint8_t  sf;
+    uint32_t freq;
+    uint32_t bandwidth_hz;
+    uint64_t start_us;
+    uint8_t  data[255];
+} sim_downlink_t;
+
+typedef mbed::Callback<void(const uint8_t *frame, uint8_t size, const sim_uplink_t &uplink)> sim_network_t;
+
+typedef struct {
+    uint32_t uplinks;
+    uint32_t uplinks_received;
+    uint32_t downlinks_queued;
+    uint32_t downlinks_received;
+    uint32_t downlinks_lost;
+    uint32_t downlinks_missed;  // Expired without a matching receive window
+    uint32_t rx_timeouts;
+} sim_radio_stats_t;
+
+class SimLoRaRadio : public LoRaRadio {
+public:
+    SimLoRaRadio(const sim_channel_config_t &config, uint32_t seed)
+        : _events(NULL), _state(RF_IDLE), _freq(0),
+          _tx_sf(7), _tx_bandwidth(125000), _tx_coderate(1), _tx_preamble(8), _tx_power(SIM_DEVICE_TX_POWER_DBM), _tx_crc(true),
+          _rx_sf(7), _rx_bandwidth(125000), _rx_coderate(1), _rx_preamble(8), _rx_symb_timeout(8), _rx_continuous(false),
+          _rx_index(-1), _rx_lost(false)
+    {
+        memset(_downlinks, 0, sizeof(_downlinks));
+        memset(&_stats, 0, sizeof(_stats));
+        memset(&_last_uplink, 0, sizeof(_last_uplink));
+        _last_uplink.link.gateway = -1;
+        sim_channel_init(config, seed);
+        _clock.start();
+    }
+
+    // Simulation time, shared with the network
+    uint64_t now_us()
+    {
+        return _clock.read_high_resolution_us();
+    }
+
+    void attach_network(sim_network_t network)
+    {
+        _network = network;
+    }
+
+    bool queue_downlink(const uint8_t *data, uint8_t size, uint32_t freq, uint8_t sf, uint32_t bandwidth_hz, uint64_t start_us, int8_t gateway)
+    {
+        uint64_t now = now_us();
+
+        for(uint8_t i = 0; i < SIM_DOWNLINK_QUEUE; i++)
+        {
+            sim_downlink_t &dl = _downlinks[i];
+
+            // Free downlinks no receive window picked up
+            if(dl.used && (i != _rx_index) && (dl.start_us + sim_time_on_air_us(dl.sf, dl.bandwidth_hz, 1, 8, dl.size, false) < now))
+            {
+                dl.used = false;
+                _stats.downlinks_missed++;
+            }
+
+            if(dl.used)
+                continue;
+
+            memcpy(dl.data, data, size);
+            dl.size         = size;
+            dl.freq         = freq;
+            dl.sf           = sf;
+            dl.bandwidth_hz = bandwidth_hz;
+            dl.start_us     = start_us;
+            dl.gateway      = gateway;
+            dl.used         = true;
+            _stats.downlinks_queued++;
+
+            // A continuous receive window picks it up when it starts
+            core_util_critical_section_enter();
+            if((_state == RF_RX_RUNNING) && _rx_continuous && (_rx_index < 0) && matches(dl, now))
+                start_reception(i);
+            core_util_critical_section_exit();
+            return true;
+        }
+
+        return false;
+    }
+
+    const sim_radio_stats_t &stats() const
+    {
+        return _stats;
+    }
+
+    void print_stats()
+    {
+        printf("Sim Uplinks           : %lu sent, %lu received\n", _stats.uplinks, _stats.uplinks_received);
+        printf("Sim Downlinks         : %lu queued, %lu received, %lu lost, %lu missed\n",
+            _stats.downlinks_queued, _stats.downlinks_received, _stats.downlinks_lost, _stats.downlinks_missed);
+        printf("Sim RX Timeouts       : %lu\n", _stats.rx_timeouts);
+        printf("Sim Last Uplink       : gw=%d gateways=%u rssi=%d snr=%d collisions=%u\n", _last_uplink.link.gateway,
+            _last_uplink.link.gateways, (int)_last_uplink.link.rssi, (int)_last_uplink.link.snr, _last_uplink.link.collisions);
+    }
+
+    virtual void init_radio(radio_events_t *events)
+    {
+        _events = events;
+    }
+
+    virtual void radio_reset()
+    {
+        idle();
+    }
+
+    virtual void sleep(void)
+    {
+        idle();
+    }
+
+    virtual void standby(void)
+    {
+        idle();
+    }
+
+    virtual void set_rx_config(radio_modems_t modem, uint32_t bandwidth, uint32_t datarate, uint8_t coderate,
+                               uint32_t bandwidth_afc, uint16_t preamble_len, uint16_t symb_timeout, bool fix_len,
+                               uint8_t payload_len, bool crc_on, bool freq_hop_on, uint8_t hop_period,
+                               bool iq_inverted, bool rx_continuous)
+    {
+        _rx_bandwidth    = bandwidth_hz(bandwidth);
+        _rx_sf           = datarate;
+        _rx_coderate     = coderate;
+        _rx_preamble     = preamble_len;
+        _rx_symb_timeout = symb_timeout;
+        _rx_continuous   = rx_continuous;
+    }
+
+    virtual void set_tx_config(radio_modems_t modem, int8_t power, uint32_t fdev, uint32_t bandwidth,
+                               uint32_t datarate, uint8_t coderate, uint16_t preamble_len, bool fix_len,
+                               bool crc_on, bool freq_hop_on, uint8_t hop_period, bool iq_inverted, uint32_t timeout)
+    {
+        _tx_power     = power;
+        _tx_bandwidth = bandwidth_hz(bandwidth);
+        _tx_sf        = datarate;
+        _tx_coderate  = coderate;
+        _tx_preamble  = preamble_len;
+        _tx_crc       = crc_on;
+    }
+
+    virtual void send(uint8_t *buffer, uint8_t size)
+    {
+        uint32_t airtime = sim_time_on_air_us(_tx_sf, _tx_bandwidth, _tx_coderate, _tx_preamble, size, _tx_crc);
+
+        _timeout.detach();
+        _state = RF_TX_RUNNING;
+
+        _last_uplink.freq         = _freq;
+        _last_uplink.sf           = _tx_sf;
+        _last_uplink.bandwidth_hz = _tx_bandwidth;
+        _last_uplink.end_us       = now_us() + airtime;
+        _last_uplink.link         = sim_channel_uplink(_tx_sf, _tx_bandwidth, _tx_power, airtime);
+
+        _stats.uplinks++;
+        if(_last_uplink.link.gateway >= 0)
+        {
+            _stats.uplinks_received++;
+            if(_network)
+                _network(buffer, size, _last_uplink);
+        }
+
+        _timeout.attach_us(mbed::callback(this, &SimLoRaRadio::tx_done_irq), airtime);
+    }
+
+    virtual void receive(void)
+    {
+        uint64_t now = now_us();
+        int8_t   next = -1;
+
+        _timeout.detach();
+        _state    = RF_RX_RUNNING;
+        _rx_index = -1;
+
+        for(uint8_t i = 0; i < SIM_DOWNLINK_QUEUE; i++)
+        {
+            if(!_downlinks[i].used || !matches(_downlinks[i], now))
+                continue;
+
+            if((next < 0) || (_downlinks[i].start_us < _downlinks[next].start_us))
+                next = i;
+        }
+
+        if(next >= 0)
+            start_reception(next);
+        else if(!_rx_continuous)
+            _timeout.attach_us(mbed::callback(this, &SimLoRaRadio::rx_timeout_irq), window_us());
+    }
+
+    virtual void set_channel(uint32_t freq)
+    {
+        _freq = freq;
+    }
+
+    virtual uint32_t random(void)
+    {
+        return sim_random();
+    }
+
+    virtual uint8_t get_status(void)
+    {
+        return _state;
+    }
+
+    virtual void set_max_payload_length(radio_modems_t modem, uint8_t max)
+    {
+    }
+
+    virtual void set_public_network(bool enable)
+    {
+    }
+
+    // In ms like the Semtech drivers
+    virtual uint32_t time_on_air(radio_modems_t modem, uint8_t pkt_len)
+    {
+        return (sim_time_on_air_us(_tx_sf, _tx_bandwidth, _tx_coderate, _tx_preamble, pkt_len, _tx_crc) + 999) / 1000;
+    }
+
+    // The channel is busy with the background traffic occupancy probability
+    virtual bool perform_carrier_sense(radio_modems_t modem, uint32_t freq, int16_t rssi_threshold, uint32_t max_carrier_sense_time)
+    {
+        uint32_t airtime = sim_time_on_air_us(_tx_sf, _tx_bandwidth, _tx_coderate, _tx_preamble, 20, true);
+
+        return (sim_random() % 1000) >= (uint32_t)(sim_channel_occupancy(airtime) * 1000);
+    }
+
+    virtual void start_cad(void)
+    {
+        if(_events && _events->cad_done)
+            _events->cad_done(false);
+    }
+
+    virtual bool check_rf_frequency(uint32_t frequency)
+    {
+        return true;
+    }
+
+    virtual void set_tx_continuous_wave(uint32_t freq, int8_t power, uint16_t time)
+    {
+    }
+
+    virtual void lock(void)
+    {
+    }
+
+    virtual void unlock(void)
+    {
+    }
+
+private:
+    static uint32_t bandwidth_hz(uint32_t bandwidth)
+    {
+        return (bandwidth == 2) ? 500000 : (bandwidth == 1) ? 250000 : 125000;
+    }
+
+    uint32_t symbol_us() const
+    {
+        return (uint32_t)(((uint64_t)1000000 << _rx_sf) / _rx_bandwidth);
+    }
+
+    uint32_t window_us() const
+    {
+        return _rx_symb_timeout * symbol_us();
+    }
+
+    // Downlink can be received by the window opening now, drops expired downlinks
+    bool matches(sim_downlink_t &dl, uint64_t now)
+    {
+        uint32_t lock_us = (_rx_preamble > SIM_PREAMBLE_LOCK_SYMS) ? (_rx_preamble - SIM_PREAMBLE_LOCK_SYMS) * symbol_us() : 0;
+
+        if(dl.start_us + lock_us < now)
+        {
+            if(dl.start_us + sim_time_on_air_us(dl.sf, dl.bandwidth_hz, _rx_coderate, _rx_preamble, dl.size, false) < now)
+            {
+                dl.used = false;
+                _stats.downlinks_missed++;
+            }
+            return false;
+        }
+
+        if((dl.freq != _freq) || (dl.sf != _rx_sf) || (dl.bandwidth_hz != _rx_bandwidth))
+            return false;
+
+        return _rx_continuous || (dl.start_us <= now + window_us());
+    }
+
+    void start_reception(int8_t index)
+    {
+        sim_downlink_t &dl = _downlinks[index];
+        uint64_t end = dl.start_us + sim_time_on_air_us(dl.sf, dl.bandwidth_hz, _rx_coderate, _rx_preamble, dl.size, false);
+        uint64_t now = now_us();
+
+        _rx_index = index;
+        _rx_link  = sim_channel_downlink(dl.gateway, dl.sf, dl.bandwidth_hz);
+        _rx_lost  = _rx_link.gateway < 0;
+
+        // A lost downlink looks like an empty window to the MAC
+        if(_rx_lost && !_rx_continuous)
+            end = now + window_us();
+
+        _timeout.attach_us(mbed::callback(this, &SimLoRaRadio::rx_done_irq), (end > now) ? end - now : 1);
+    }
+
+    void idle()
+    {
+        _timeout.detach();
+        _state    = RF_IDLE;
+        _rx_index = -1;
+    }
+
+    void tx_done_irq()
+    {
+        _state = RF_IDLE;
+        if(_events && _events->tx_done)
+            _events->tx_done();
+    }
+
+    void rx_timeout_irq()
+    {
+        _state = RF_IDLE;
+        _stats.rx_timeouts++;
+        if(_events && _events->rx_timeout)
+            _events->rx_timeout();
+    }
+
+    void rx_done_irq()
+    {
+        sim_downlink_t &dl = _downlinks[_rx_index];
+
+        _rx_index = -1;
+        dl.used   = false;
+
+        if(_rx_lost)
+        {
+            _stats.downlinks_lost++;
+            if(_rx_continuous)
+                receive();
+            else
+                rx_timeout_irq();
+            return;
+        }
+
+        if(!_rx_continuous)
+            _state = RF_IDLE;
+
+        _stats.downlinks_received++;
+        if(_events && _events->rx_done)
+            _events->rx_done(dl.data, dl.size, (int16_t)_rx_link.rssi, (int8_t)_rx_link.snr);
+    }
+
+    radio_events_t   *_events;
+    Timeout           _timeout;
+    LowPowerTimer     _clock;
+    sim_network_t     _network;
+    volatile uint8_t  _state;
+    uint32_t          _freq;
+
+    uint8_t           _tx_sf;
+    uint32_t          _tx_bandwidth;
+    uint8_t           _tx_coderate;
+    uint16_t          _tx_preamble;
+    int8_t            _tx_power;
+    bool              _tx_crc;
+
+    uint8_t           _rx_sf;
+    uint32_t          _rx_bandwidth;
+    uint8_t           _rx_coderate;
+    uint16_t          _rx_preamble;
+    uint16_t          _rx_symb_timeout;
+    bool              _rx_continuous;
+
+    sim_downlink_t    _downlinks[SIM_DOWNLINK_QUEUE];
+    int8_t            _rx_index;
+    bool              _rx_lost;
+    sim_link_t        _rx_link;
+    sim_uplink_t      _last_uplink;
+    sim_radio_stats_t _stats;
+};
+
+#endif // _SIM_RADIO_HELPER_H
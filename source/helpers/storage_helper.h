@@ -23,15 +23,20 @@
 #if defined(TARGET_SIMULATOR)
 // Initialize a persistent block device with 528 bytes block size, and 256 blocks (mimicks the at45, which also has 528 size blocks)
 #include "SimulatorBlockDevice.h"
+#define FUOTA_STORAGE_PRESENT 1
 SimulatorBlockDevice bd("lorawan-frag-in-flash", 256 * 528, static_cast<uint64_t>(528));
 #elif defined(TARGET_FF1705_L151CC)
 // Flash interface on the L-TEK xDot shield
 #include "AT45BlockDevice.h"
+#define FUOTA_STORAGE_PRESENT 1
 AT45BlockDevice bd(SPI_MOSI, SPI_MISO, SPI_SCK, SPI_NSS);
 #elif defined(COMPONENT_QSPIF)
 // QSPI Flash interface
 #include "QSPIFBlockDevice.h"
+#define FUOTA_STORAGE_PRESENT 1
 QSPIFBlockDevice bd(QSPI_FLASH1_IO0, QSPI_FLASH1_IO1, QSPI_FLASH1_IO2, QSPI_FLASH1_IO3, QSPI_FLASH1_SCK, QSPI_FLASH1_CSN, QSPIF_POLARITY_MODE_0, MBED_CONF_QSPIF_QSPI_FREQ);
+#else
+#define FUOTA_STORAGE_PRESENT 0
 #endif
 
 #endif // _LORAWAN_FUOTA_STORAGE_HELPER_H
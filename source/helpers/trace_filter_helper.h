@@ -0,0 +1,270 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _TRACE_FILTER_HELPER_H
+#define _TRACE_FILTER_HELPER_H
+
+#include "mbed.h"
+#include "mbed_trace.h"
+
+/**
+ * Runtime level and group filter for mbed_trace, and the cost of the traces.
+ *
+ * Levels above mbed-trace.max-level are compiled out of the image, the
+ * runtime level can only lower the verbosity further. Groups are the
+ * TRACE_GROUP names of the LoRaWAN stack, a cleared bit in the mask
+ * silences that group. mbed_trace matches a group against the exclude
+ * filter with strstr, so LMAC and LMACC share one bit: an "LMAC" filter
+ * silences both, an "LMACC" one would silence LMAC too.
+ *
+ * Every printed trace line is timed with the low power timer, so the
+ * measurement does not lock deep sleep. That is the CPU time of the calling
+ * thread, with the deferred console of log_helper.h the UART write happens
+ * later on the console thread. The UART time is derived from the bytes at
+ * the console baud rate, 10 bits per byte.
+ *
+ * Call trace_filter_cycle_mark() once per uplink cycle to get the lines,
+ * bytes and time spent tracing in that cycle. The cycle average restarts
+ * when the level or the groups change and the average of the previous
+ * setting is kept, so the time saved per cycle by a change is printed.
+ */
+
+#define TRACE_FILTER_LEVEL_NONE     0
+#define TRACE_FILTER_LEVEL_ERROR    1
+#define TRACE_FILTER_LEVEL_WARN     2
+#define TRACE_FILTER_LEVEL_INFO     3
+#define TRACE_FILTER_LEVEL_DEBUG    4
+#define TRACE_FILTER_LEVEL_MAX      TRACE_FILTER_LEVEL_DEBUG
+
+#define TRACE_FILTER_GROUPS_ALL     0xffff
+#define TRACE_FILTER_UART_BAUD      MBED_CONF_PLATFORM_STDIO_BAUD_RATE
+
+typedef struct {
+    uint32_t lines;
+    uint32_t bytes;
+    uint32_t time_us;
+} trace_filter_cost_t;
+
+// Index is the level of the console and configuration commands
+static const char *const trace_filter_level_names[] = { "none", "error", "warn", "info", "debug" };
+static const uint8_t trace_filter_active_level[] = {
+    TRACE_ACTIVE_LEVEL_NONE, TRACE_ACTIVE_LEVEL_ERROR, TRACE_ACTIVE_LEVEL_WARN,
+    TRACE_ACTIVE_LEVEL_INFO, TRACE_ACTIVE_LEVEL_DEBUG
+};
+static const uint8_t trace_filter_trace_level[] = {
+    0, TRACE_LEVEL_ERROR, TRACE_LEVEL_WARN, TRACE_LEVEL_INFO, TRACE_LEVEL_DEBUG
+};
+
+// Bit n of the group mask is trace_filter_groups[n], "LMAC" also matches LMACC
+static const char *const trace_filter_groups[] = { "LSTK", "LMAC", "LPHY", "LCHP", "LCRY" };
+#define TRACE_FILTER_GROUP_COUNT (sizeof(trace_filter_groups) / sizeof(trace_filter_groups[0]))
+
+static uint8_t             trace_filter_level  = TRACE_FILTER_LEVEL_DEBUG;
+static uint16_t            trace_filter_mask   = TRACE_FILTER_GROUPS_ALL;
+static bool                trace_filter_active = false;
+// mbed_trace keeps the pointer to the exclude filter
+static char                trace_filter_exclude[TRACE_FILTER_GROUP_COUNT * 6 + 1];
+static LowPowerTimer       trace_filter_timer;
+static trace_filter_cost_t trace_filter_total;
+static trace_filter_cost_t trace_filter_base;
+static trace_filter_cost_t trace_filter_cycle_start;
+static trace_filter_cost_t trace_filter_last_cycle;
+static uint32_t            trace_filter_cycles = 0;
+// Cycle average of the previous level and groups
+static trace_filter_cost_t trace_filter_prev_avg;
+static uint32_t            trace_filter_prev_cycles = 0;
+static uint8_t             trace_filter_prev_level;
+static uint16_t            trace_filter_prev_mask;
+static uint8_t             trace_filter_measured_level;
+static uint16_t            trace_filter_measured_mask;
+
+#if MBED_CONF_MBED_TRACE_ENABLE
+static void trace_filter_print(const char *str)
+{
+    uint32_t start = trace_filter_timer.read_us();
+
+    puts(str);
+
+    trace_filter_total.time_us += trace_filter_timer.read_us() - start;
+    trace_filter_total.bytes   += strlen(str) + 2;
+    trace_filter_total.lines++;
+}
+#endif
+
+// True when the level is not compiled out by mbed-trace.max-level
+bool trace_filter_level_compiled(uint8_t level)
+{
+    return (level <= TRACE_FILTER_LEVEL_MAX) && (trace_filter_trace_level[level] <= MBED_TRACE_MAX_LEVEL);
+}
+
+// UART time of bytes at the console baud rate
+static uint32_t trace_filter_uart_us(uint32_t bytes)
+{
+    return (uint32_t)((uint64_t)bytes * 10 * 1000000 / TRACE_FILTER_UART_BAUD);
+}
+
+static void trace_filter_average(trace_filter_cost_t &avg)
+{
+    uint32_t cycles = trace_filter_cycles ? trace_filter_cycles : 1;
+
+    avg.lines   = (trace_filter_cycle_start.lines - trace_filter_base.lines) / cycles;
+    avg.bytes   = (trace_filter_cycle_start.bytes - trace_filter_base.bytes) / cycles;
+    avg.time_us = (trace_filter_cycle_start.time_us - trace_filter_base.time_us) / cycles;
+}
+
+// Start a new measurement, the running cycle is counted with the new settings
+static void trace_filter_restart()
+{
+    if(trace_filter_cycles > 0)
+    {
+        trace_filter_average(trace_filter_prev_avg);
+        trace_filter_prev_cycles = trace_filter_cycles;
+        trace_filter_prev_level  = trace_filter_measured_level;
+        trace_filter_prev_mask   = trace_filter_measured_mask;
+    }
+
+    trace_filter_measured_level = trace_filter_level;
+    trace_filter_measured_mask  = trace_filter_mask;
+    trace_filter_base        = trace_filter_total;
+    trace_filter_cycle_start = trace_filter_total;
+    trace_filter_cycles      = 0;
+}
+
+static void trace_filter_apply()
+{
+    uint8_t mode = mbed_trace_config_get() & ~TRACE_MASK_LEVEL;
+    char   *p = trace_filter_exclude;
+
+    mbed_trace_config_set(mode | trace_filter_active_level[trace_filter_level]);
+
+    for(uint8_t i = 0; i < TRACE_FILTER_GROUP_COUNT; i++)
+    {
+        if(!(trace_filter_mask & (1 << i)))
+        {
+            if(p != trace_filter_exclude)
+                *p++ = ',';
+            strcpy(p, trace_filter_groups[i]);
+            p += strlen(trace_filter_groups[i]);
+        }
+    }
+    *p = '\0';
+
+    mbed_trace_exclude_filters_set((p != trace_filter_exclude) ? trace_filter_exclude : NULL);
+    trace_filter_restart();
+}
+
+// Level and groups can be set before the trace is initialized, e.g. from the persisted configuration
+bool trace_filter_set_level(uint8_t level)
+{
+    if(level > TRACE_FILTER_LEVEL_MAX)
+        return false;
+
+    trace_filter_level = level;
+    if(trace_filter_active)
+        trace_filter_apply();
+
+    return true;
+}
+
+void trace_filter_set_groups(uint16_t mask)
+{
+    trace_filter_mask = mask;
+    if(trace_filter_active)
+        trace_filter_apply();
+}
+
+uint8_t trace_filter_get_level()
+{
+    return trace_filter_level;
+}
+
+uint16_t trace_filter_get_groups()
+{
+    return trace_filter_mask;
+}
+
+// Replaces mbed_trace_init()
+void trace_filter_init()
+{
+    mbed_trace_init();
+#if MBED_CONF_MBED_TRACE_ENABLE
+    mbed_trace_print_function_set(trace_filter_print);
+#endif
+    trace_filter_timer.start();
+    memset(&trace_filter_total, 0, sizeof(trace_filter_total));
+    trace_filter_active = true;
+    trace_filter_apply();
+}
+
+void trace_filter_cycle_mark()
+{
+    trace_filter_last_cycle.lines   = trace_filter_total.lines - trace_filter_cycle_start.lines;
+    trace_filter_last_cycle.bytes   = trace_filter_total.bytes - trace_filter_cycle_start.bytes;
+    trace_filter_last_cycle.time_us = trace_filter_total.time_us - trace_filter_cycle_start.time_us;
+    trace_filter_cycle_start = trace_filter_total;
+    trace_filter_cycles++;
+}
+
+static const char *trace_filter_compiled_name()
+{
+    uint8_t level = TRACE_FILTER_LEVEL_NONE;
+
+    while(trace_filter_level_compiled(level + 1))
+        level++;
+
+    return trace_filter_level_names[level];
+}
+
+// Signed difference for the saved time, negative when the new setting costs more
+static long trace_filter_saved(uint32_t before, uint32_t after)
+{
+    return (long)before - (long)after;
+}
+
+void trace_filter_print_stats()
+{
+    trace_filter_cost_t avg;
+
+    trace_filter_average(avg);
+
+    printf("Trace Level           : %s (compiled up to %s)\n", trace_filter_level_names[trace_filter_level],
+        trace_filter_compiled_name());
+    printf("Trace Groups          : %04x", trace_filter_mask);
+    for(uint8_t i = 0; i < TRACE_FILTER_GROUP_COUNT; i++)
+        printf(" %s=%s", trace_filter_groups[i], (trace_filter_mask & (1 << i)) ? "on" : "off");
+    printf("\n");
+    printf("Trace Total           : %lu lines, %lu bytes, %lu ms\n", trace_filter_total.lines,
+        trace_filter_total.bytes, trace_filter_total.time_us / 1000);
+    printf("Trace Last Cycle      : %lu lines, %lu bytes, CPU %lu us, UART %lu us\n", trace_filter_last_cycle.lines,
+        trace_filter_last_cycle.bytes, trace_filter_last_cycle.time_us, trace_filter_uart_us(trace_filter_last_cycle.bytes));
+    printf("Trace Cycle Average   : %lu lines, %lu bytes, CPU %lu us, UART %lu us over %lu cycles\n",
+        avg.lines, avg.bytes, avg.time_us, trace_filter_uart_us(avg.bytes), trace_filter_cycles);
+
+    if(trace_filter_prev_cycles == 0)
+        return;
+
+    printf("Trace Previous Average: %lu lines, %lu bytes, CPU %lu us, UART %lu us over %lu cycles (%s, %04x)\n",
+        trace_filter_prev_avg.lines, trace_filter_prev_avg.bytes, trace_filter_prev_avg.time_us,
+        trace_filter_uart_us(trace_filter_prev_avg.bytes), trace_filter_prev_cycles,
+        trace_filter_level_names[trace_filter_prev_level], trace_filter_prev_mask);
+    if(trace_filter_cycles > 0)
+        printf("Trace Saved Per Cycle : CPU %ld us, UART %ld us\n",
+            trace_filter_saved(trace_filter_prev_avg.time_us, avg.time_us),
+            trace_filter_saved(trace_filter_uart_us(trace_filter_prev_avg.bytes), trace_filter_uart_us(avg.bytes)));
+}
+
+#endif // _TRACE_FILTER_HELPER_H
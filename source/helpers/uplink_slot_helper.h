@@ -0,0 +1,92 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _UPLINK_SLOT_HELPER_H
+#define _UPLINK_SLOT_HELPER_H
+
+#include "mbed.h"
+
+/**
+ * Uplink slotting to keep a fleet from transmitting in lockstep.
+ *
+ * Each device gets a stable phase offset within the uplink interval derived
+ * from a hash of its DevEUI, plus a bounded per-cycle jitter from a generator
+ * seeded with the same hash. The phase can be anchored to GPS time, which
+ * Class B devices track through the beacon, so the schedule of the fleet stays
+ * spread out independently of when each device joined.
+ *
+ * The default jitter comes from tools/fleet_collision_sim.py, which uses the
+ * same hash and generator.
+ */
+
+#define UPLINK_SLOT_JITTER_PCT      MBED_CONF_APP_UPLINK_SLOT_JITTER_PCT
+
+static uint32_t uplink_slot_hash  = 0;
+static uint32_t uplink_slot_state = 0;
+
+// FNV-1a over the DevEUI
+void uplink_slot_init(const uint8_t *dev_eui, uint8_t size)
+{
+    uint32_t hash = 2166136261UL;
+
+    for(uint8_t i = 0; i < size; i++)
+    {
+        hash ^= dev_eui[i];
+        hash *= 16777619UL;
+    }
+
+    uplink_slot_hash  = hash;
+    uplink_slot_state = hash ? hash : 1;
+}
+
+// Stable offset of this device within an interval
+uint32_t uplink_slot_phase_ms(uint32_t interval_ms)
+{
+    return interval_ms ? uplink_slot_hash % interval_ms : 0;
+}
+
+// Jitter in [-interval * pct / 100, +interval * pct / 100]
+int32_t uplink_slot_jitter_ms(uint32_t interval_ms)
+{
+    uint32_t span = (uint32_t)(((uint64_t)interval_ms * UPLINK_SLOT_JITTER_PCT) / 100);
+
+    // xorshift32
+    uplink_slot_state ^= uplink_slot_state << 13;
+    uplink_slot_state ^= uplink_slot_state >> 17;
+    uplink_slot_state ^= uplink_slot_state << 5;
+
+    if(span == 0)
+        return 0;
+
+    return (int32_t)(uplink_slot_state % (2 * span + 1)) - (int32_t)span;
+}
+
+// Delay from gps_time_ms to the slot of this device on the GPS time grid closest to one interval later
+uint32_t uplink_slot_gps_delay_ms(uint64_t gps_time_ms, uint32_t interval_ms)
+{
+    uint32_t half = interval_ms / 2;
+    uint32_t position;
+
+    if(interval_ms == 0)
+        return 0;
+
+    position = (uint32_t)((gps_time_ms + half) % interval_ms);
+
+    return half + (uplink_slot_phase_ms(interval_ms) + interval_ms - position) % interval_ms;
+}
+
+#endif // _UPLINK_SLOT_HELPER_H
@@ -0,0 +1,292 @@
+/*
+ * PackageLicenseDeclared: Apache-2.0
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _WATCHDOG_HELPER_H
+#define _WATCHDOG_HELPER_H
+
+#include "mbed.h"
+#include "mbed_events.h"
+#include "kvstore_global_api.h"
+#include "event_trace_helper.h"
+
+/**
+ * Event loop watchdog with stall detection and a post-mortem record.
+ *
+ * A heartbeat event on the radio queue stamps the time it ran. A low power
+ * ticker (it also runs from deep sleep, where the hardware watchdog keeps
+ * counting) kicks the hardware watchdog only while the heartbeat is recent
+ * and no tracked handler is past its deadline.
+ *
+ * On a stall the ticker fills a post-mortem record (reason, handler, state
+ * flags, mailbox depth, last trace records) and stops kicking. The record is
+ * written to KVStore from the console queue, which has its own thread in
+ * RTOS builds, and the device resets. Bare metal builds chain the console
+ * queue to the radio queue, there the hardware watchdog resets the device
+ * and only the reset reason is reported.
+ *
+ * Handlers running on the radio queue are tracked with a WatchdogScope on
+ * their stack.
+ */
+
+#define WATCHDOG_TIMEOUT_MS         MBED_CONF_APP_WATCHDOG_TIMEOUT
+#define WATCHDOG_KICK_MS            (WATCHDOG_TIMEOUT_MS / 4)
+#define WATCHDOG_HEARTBEAT_MS       (WATCHDOG_TIMEOUT_MS / 4)
+#define WATCHDOG_STALL_MS           (WATCHDOG_TIMEOUT_MS / 2)
+#define WATCHDOG_SCOPE_DEPTH        4
+#define WATCHDOG_RECORDS            8
+#define WATCHDOG_REPORT_RECORDS     2
+#define WATCHDOG_REPORT_SIZE        (7 + 2 * WATCHDOG_REPORT_RECORDS)
+#define WATCHDOG_KEY                "/kv/postmortem"
+#define WATCHDOG_MAGIC              0x57444f47
+
+// Stall reasons, a reset without a record reports the reset reason instead
+#define WATCHDOG_REASON_NONE        0
+#define WATCHDOG_REASON_HEARTBEAT   1
+#define WATCHDOG_REASON_HANDLER     2
+#define WATCHDOG_REASON_RESET       3
+
+// Tracked handlers
+#define WATCHDOG_HANDLER_NONE       0
+#define WATCHDOG_HANDLER_EVENT      1
+#define WATCHDOG_HANDLER_SEND       2
+#define WATCHDOG_HANDLER_RECEIVE    3
+#define WATCHDOG_HANDLER_COMMAND    4
+
+typedef struct {
+    uint32_t             magic;
+    uint8_t              reason;
+    uint8_t              handler;
+    uint8_t              flags;         // Application state flags, see event_trace_helper.h
+    uint8_t              depth;         // Messages waiting in the application mailboxes
+    uint32_t             uptime_ms;
+    uint32_t             stalled_ms;
+    uint16_t             records;
+    event_trace_record_t record[WATCHDOG_RECORDS];
+} watchdog_snapshot_t;
+
+typedef struct {
+    uint8_t  handler;
+    uint32_t start_ms;
+    uint32_t deadline_ms;
+} watchdog_scope_t;
+
+static LowPowerTicker       watchdog_ticker;
+static LowPowerTimer        watchdog_timer;
+static volatile uint32_t    watchdog_heartbeat_ms = 0;
+static watchdog_scope_t     watchdog_scope[WATCHDOG_SCOPE_DEPTH];
+static volatile uint8_t     watchdog_scope_depth = 0;
+static bool                 watchdog_stalled = false;
+static watchdog_snapshot_t  watchdog_snapshot;
+static uint8_t              watchdog_report_buffer[WATCHDOG_REPORT_SIZE];
+static uint8_t              watchdog_report_size = 0;
+static uint8_t            (*watchdog_state_flags)() = NULL;
+static uint8_t            (*watchdog_queue_depth)() = NULL;
+static EventQueue          *watchdog_save_queue = NULL;
+static void               (*watchdog_before_reset)() = NULL;
+
+class WatchdogScope {
+public:
+    WatchdogScope(uint8_t handler, uint32_t deadline_ms)
+    {
+        uint8_t depth = watchdog_scope_depth;
+
+        if(depth < WATCHDOG_SCOPE_DEPTH)
+        {
+            watchdog_scope[depth].handler     = handler;
+            watchdog_scope[depth].start_ms    = watchdog_timer.read_ms();
+            watchdog_scope[depth].deadline_ms = deadline_ms;
+        }
+        watchdog_scope_depth = depth + 1;
+    }
+
+    ~WatchdogScope()
+    {
+        watchdog_scope_depth = watchdog_scope_depth - 1;
+    }
+};
+
+static void watchdog_heartbeat()
+{
+    watchdog_heartbeat_ms = watchdog_timer.read_ms();
+}
+
+static void watchdog_save()
+{
+    printf("Watchdog: stall detected, reason=%u handler=%u, resetting\n",
+        watchdog_snapshot.reason, watchdog_snapshot.handler);
+    kv_set(WATCHDOG_KEY, &watchdog_snapshot, sizeof(watchdog_snapshot), 0);
+    if(watchdog_before_reset)
+        watchdog_before_reset();
+    NVIC_SystemReset();
+}
+
+static void watchdog_stall(uint8_t reason, uint8_t handler, uint32_t stalled_ms)
+{
+    watchdog_snapshot.magic      = WATCHDOG_MAGIC;
+    watchdog_snapshot.reason     = reason;
+    watchdog_snapshot.handler    = handler;
+    watchdog_snapshot.flags      = watchdog_state_flags ? watchdog_state_flags() : 0;
+    watchdog_snapshot.depth      = watchdog_queue_depth ? watchdog_queue_depth() : 0;
+    watchdog_snapshot.uptime_ms  = watchdog_timer.read_ms();
+    watchdog_snapshot.stalled_ms = stalled_ms;
+    watchdog_snapshot.records    = event_trace_last(watchdog_snapshot.record, WATCHDOG_RECORDS);
+
+    watchdog_stalled = true;
+    if(watchdog_save_queue)
+        watchdog_save_queue->call(watchdog_save);
+}
+
+// Low power ticker interrupt
+static void watchdog_check()
+{
+    uint32_t now = watchdog_timer.read_ms();
+    uint8_t  depth = watchdog_scope_depth;
+
+    if(watchdog_stalled)
+        return;
+
+    if(now - watchdog_heartbeat_ms > WATCHDOG_STALL_MS)
+    {
+        watchdog_stall(WATCHDOG_REASON_HEARTBEAT, (depth && depth <= WATCHDOG_SCOPE_DEPTH) ?
+            watchdog_scope[depth - 1].handler : WATCHDOG_HANDLER_NONE, now - watchdog_heartbeat_ms);
+        return;
+    }
+
+    for(uint8_t i = 0; i < depth && i < WATCHDOG_SCOPE_DEPTH; i++)
+    {
+        if(now - watchdog_scope[i].start_ms > watchdog_scope[i].deadline_ms)
+        {
+            watchdog_stall(WATCHDOG_REASON_HANDLER, watchdog_scope[i].handler, now - watchdog_scope[i].start_ms);
+            return;
+        }
+    }
+
+#if DEVICE_WATCHDOG
+    Watchdog::get_instance().kick();
+#endif
+}
+
+// Uplink report, fits the 11 bytes of US915 DR0: reason, handler, flags, depth,
+// stalled seconds, uptime minutes (2 bytes) then type and code of the last
+// trace records. Counters saturate.
+static void watchdog_build_report(const watchdog_snapshot_t &snapshot)
+{
+    uint8_t *p = watchdog_report_buffer;
+    uint32_t stalled_s = snapshot.stalled_ms / 1000;
+    uint32_t uptime_min = snapshot.uptime_ms / 60000;
+
+    *p++ = snapshot.reason;
+    *p++ = snapshot.handler;
+    *p++ = snapshot.flags;
+    *p++ = snapshot.depth;
+    *p++ = (stalled_s > 0xff) ? 0xff : stalled_s;
+    *p++ = (uptime_min > 0xffff) ? 0xff : (uptime_min >> 8);
+    *p++ = (uptime_min > 0xffff) ? 0xff : (uptime_min & 0xff);
+
+    for(uint16_t i = 0; i < WATCHDOG_REPORT_RECORDS; i++)
+    {
+        uint16_t index = snapshot.records - WATCHDOG_REPORT_RECORDS + i;
+        bool     valid = (snapshot.records >= WATCHDOG_REPORT_RECORDS - i);
+
+        *p++ = valid ? snapshot.record[index].type : 0;
+        *p++ = valid ? snapshot.record[index].code : 0;
+    }
+
+    watchdog_report_size = p - watchdog_report_buffer;
+}
+
+void watchdog_print_snapshot(const watchdog_snapshot_t &snapshot)
+{
+    printf("Watchdog post-mortem  : reason=%u handler=%u flags=%02x depth=%u uptime=%lu ms stalled=%lu ms\n",
+        snapshot.reason, snapshot.handler, snapshot.flags, snapshot.depth, snapshot.uptime_ms, snapshot.stalled_ms);
+    event_trace_print(snapshot.record, snapshot.records, 0);
+}
+
+// Load the record of the previous stall, reported by the first uplink
+static void watchdog_load_snapshot()
+{
+    watchdog_snapshot_t snapshot;
+    size_t actual_size = 0;
+
+    int rc = kv_get(WATCHDOG_KEY, &snapshot, sizeof(snapshot), &actual_size);
+    if((rc == MBED_SUCCESS) && (actual_size == sizeof(snapshot)) && (snapshot.magic == WATCHDOG_MAGIC) &&
+       (snapshot.records <= WATCHDOG_RECORDS))
+    {
+        watchdog_print_snapshot(snapshot);
+        watchdog_build_report(snapshot);
+        kv_remove(WATCHDOG_KEY);
+        return;
+    }
+
+#if DEVICE_RESET_REASON
+    if(ResetReason::get() == RESET_REASON_WATCHDOG)
+    {
+        memset(&snapshot, 0, sizeof(snapshot));
+        snapshot.reason = WATCHDOG_REASON_RESET;
+        printf("Watchdog reset without post-mortem record\n");
+        watchdog_build_report(snapshot);
+    }
+#endif
+}
+
+// Starts the hardware watchdog, the heartbeat runs once queue is dispatched.
+// The post-mortem record is written from save_queue.
+void watchdog_init(EventQueue *queue, EventQueue *save_queue, uint8_t (*state_flags)(), uint8_t (*queue_depth)())
+{
+    watchdog_save_queue  = save_queue;
+    watchdog_state_flags = state_flags;
+    watchdog_queue_depth = queue_depth;
+    watchdog_timer.start();
+
+    watchdog_load_snapshot();
+
+    if(WATCHDOG_TIMEOUT_MS == 0)
+        return;
+
+#if DEVICE_WATCHDOG
+    Watchdog::get_instance().start(WATCHDOG_TIMEOUT_MS);
+#endif
+    watchdog_heartbeat_ms = watchdog_timer.read_ms();
+    queue->call_every(WATCHDOG_HEARTBEAT_MS, watchdog_heartbeat);
+    watchdog_ticker.attach_us(watchdog_check, WATCHDOG_KICK_MS * 1000);
+}
+
+// Called on the save queue after the post-mortem record is written, right before the stall reset
+void watchdog_attach_reset(void (*before_reset)())
+{
+    watchdog_before_reset = before_reset;
+}
+
+// Report of the previous stall for the first uplink, 0 when there is none
+uint8_t watchdog_report(uint8_t *buffer, uint8_t max_size)
+{
+    uint8_t size = watchdog_report_size;
+
+    if((size == 0) || (size > max_size))
+        return 0;
+
+    memcpy(buffer, watchdog_report_buffer, size);
+    return size;
+}
+
+// The report went out
+void watchdog_report_sent()
+{
+    watchdog_report_size = 0;
+}
+
+#endif // _WATCHDOG_HELPER_H
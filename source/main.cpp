@@ -1,11 +1,45 @@
 #include "mbed.h"
 #include "platform/CircularBuffer.h"
 #include "ctype.h"
+#if MBED_CONF_APP_LOW_POWER
+#include "hal/gpio_irq_api.h"
+#include "hal/pinmap.h"
+#include "hal/serial_api.h"
+#endif
+#if MBED_CONF_APP_LOW_POWER && !defined(MBED_TICKLESS)
+#warning "low-power without MBED_TICKLESS, the RTOS tick keeps the MCU out of deep sleep. Build with make <target>-lowpower"
+#endif
 
 #include "mbed_trace.h"
 #include "mbed_events.h"
 #include "lora_radio_helper.h"
 #include "dev_eui_helper.h"
+#include "power_helper.h"
+#include "event_trace_helper.h"
+#include "uplink_slot_helper.h"
+#include "beacon_history_helper.h"
+#include "queue_helper.h"
+#include "log_helper.h"
+#include "port_router_helper.h"
+#include "storage_helper.h"
+#include "trace_filter_helper.h"
+#include "watchdog_helper.h"
+#include "boot_helper.h"
+#include "persist_helper.h"
+#include "adr_assist_helper.h"
+#include "config_snapshot_helper.h"
+#if MBED_CONF_APP_PERF_BENCHMARKS
+#include "perf_helper.h"
+#include "HeapBlockDevice.h"
+#include "TDBStore.h"
+#endif
+#if FUOTA_STORAGE_PRESENT
+#include "frag_session_helper.h"
+#endif
+#if (MBED_CONF_APP_LORA_RADIO == SIM) && MBED_CONF_APP_SIM_NETWORK_SERVER
+#define SIM_NETWORK_SERVER 1
+#include "ns_emulator_helper.h"
+#endif
 #include "LoRaWANInterface.h"
 #include "platform/Callback.h"
 #include "KVStore.h"
@@ -30,6 +64,10 @@
 #define SET_PING_SLOT_PERIODICITY 5
 #define SEND_LINK_CHECK_REQ       6
 #define SEND_DEVICE_TIME_REQ      7
+#define SET_TRACE_LEVEL           8
+#define SET_TRACE_GROUPS          9
+#define GET_CONFIG_SNAPSHOT       10
+#define SET_CONFIG_SNAPSHOT       11
 #define RESET_NONVOL_CMD          254 
 #define SW_RESET_CMD              255 
 
@@ -39,6 +77,8 @@ static const char* NVSTORE_UPLINK_MSGTYPE_KEY      = "/kv/uplinktype";
 static const char*  NVSTORE_ADR_ON_KEY             = "/kv/adron" ;
 static const char*  NVSTORE_DEVICE_CLASS_KEY       = "/kv/devclass"; 
 static const char*  NVSTORE_PING_SLOT_PERIODICITY  = "/kv/pingslotperiod";
+static const char*  NVSTORE_TRACE_LEVEL_KEY        = "/kv/tracelevel";
+static const char*  NVSTORE_TRACE_GROUPS_KEY       = "/kv/tracegroups";
 
 #define  DEVICE_CLASS xstr(MBED_CONF_APP_LORA_DEVICE_CLASS)
 
@@ -70,11 +110,64 @@ static bool           use_builtin_deveui    = true;
 static mbed::DigitalOut dbg_rx(MBED_CONF_APP_LORA_RX_PIN); 
 static RawSerial pc(USBTX, USBRX);
 
+#if MBED_CONF_RTOS_PRESENT
+// Console output of the radio thread is written out by the console thread, see log_helper.h
+static LogConsole<MBED_CONF_APP_LOG_BUFFER_SIZE> log_console(pc);
+
+FileHandle *mbed::mbed_override_console(int fd)
+{
+    return &log_console;
+}
+#endif
+
+// Console state, the attached serial Rx interrupt holds a deep sleep lock
+static bool console_attached = false;
+#if MBED_CONF_APP_LOW_POWER
+static gpio_irq_t  console_wake;
+static bool        console_wake_armed = false;
+static int         console_idle_event = 0;
+#endif
+
 #define SERIAL_RX_BUF_SIZE 80
-static EventQueue serial_rx_queue;
 static CircularBuffer<char, SERIAL_RX_BUF_SIZE> serial_rx_buffer;
 static uint8_t  serial_command[SERIAL_RX_BUF_SIZE/2];
 
+// Serial commands, console queue -> radio queue
+typedef struct {
+    uint8_t data[SERIAL_RX_BUF_SIZE/2];
+    uint8_t size;
+} command_msg_t;
+
+// Settings to write to KVStore, radio queue -> console queue. A NULL key removes all settings
+typedef struct {
+    const char *key;
+    uint8_t     value[4];
+    uint8_t     size;
+} persist_msg_t;
+
+static SpscMailbox<command_msg_t, 4> command_mailbox;
+static SpscMailbox<persist_msg_t, 8> persist_mailbox;
+
+#if FUOTA_STORAGE_PRESENT
+// Fragmentation downlinks, radio queue -> console queue. The session setup erases
+// the image area and coded fragments read back stored ones, block device operations
+// that can take seconds, so the commands run on the console queue.
+typedef struct {
+    uint8_t data[FRAG_MAX_SIZE + 3];
+    uint8_t size;
+    bool    multicast;
+} frag_msg_t;
+
+// Answers, console queue -> radio queue
+typedef struct {
+    uint8_t data[16];
+    uint8_t size;
+} frag_answer_t;
+
+static SpscMailbox<frag_msg_t, 4>    frag_mailbox;
+static SpscMailbox<frag_answer_t, 2> frag_answer_mailbox;
+#endif
+
 typedef struct {
     uint16_t rx;
     uint16_t beacon_lock;
@@ -83,19 +176,42 @@ typedef struct {
 
 app_data_frame_t app_data;
 
+#define APP_PAYLOAD_SIZE     6
+#define APP_PAYLOAD_MAX_SIZE (APP_PAYLOAD_SIZE + 3)
+
 // Device credentials, register device as OTAA in The Things Network and copy credentials here
 static uint8_t DEV_EUI[] = MBED_CONF_LORA_DEVICE_EUI;
 static uint8_t APP_EUI[] = MBED_CONF_LORA_APPLICATION_EUI;
 static uint8_t APP_KEY[] = MBED_CONF_LORA_APPLICATION_KEY;
 
 static void queue_next_send_message();
-static void print_received_beacon();
-static void receive_command(uint8_t* buffer, int size);
+static void print_received_beacon(uint64_t local_us);
+static void receive_command(const uint8_t* buffer, int size, bool downlink);
 static void display_command_help();
 static void display_app_info();
-
-// EventQueue is required to dispatch events around
-static EventQueue ev_queue;
+static void console_attach();
+static void console_restart_idle_timer();
+void print_return_code(int rc, int expected_rc);
+#if MBED_CONF_APP_PERF_BENCHMARKS
+static void run_benchmarks();
+#endif
+
+// EventQueue is required to dispatch events around. The stack runs on ev_queue,
+// the console, network time display and KVStore writes run on console_queue.
+// With RTOS ev_queue has its own high priority thread and main dispatches
+// console_queue, without RTOS console_queue is chained to ev_queue.
+// Queue buffers and the radio thread stack are static, nothing is taken from the heap.
+static unsigned char ev_queue_buffer[EVENTS_QUEUE_SIZE];
+static unsigned char console_queue_buffer[EVENTS_QUEUE_SIZE];
+static EventQueue ev_queue(sizeof(ev_queue_buffer), ev_queue_buffer);
+static EventQueue console_queue(sizeof(console_queue_buffer), console_queue_buffer);
+#if MBED_CONF_RTOS_PRESENT
+static MBED_ALIGN(8) unsigned char radio_thread_stack[MBED_CONF_APP_RADIO_THREAD_STACK_SIZE];
+static Thread radio_thread(osPriorityHigh, sizeof(radio_thread_stack), radio_thread_stack, "radio");
+#endif
+
+static queue_probe_t radio_probe;
+static queue_probe_t console_probe;
 
 // Constructing Mbed LoRaWANInterface and passing it down the radio object.
 static LoRaWANInterface lorawan(radio);
@@ -112,6 +228,22 @@ static void link_check_response(uint8_t demod_margin, uint8_t gw_cnt);
 // Set device class helper
 static lorawan_status_t set_device_class(device_class_t device_class);
 
+// Downlink port handlers
+static void config_port_handler(const uint8_t *buffer, uint8_t size, uint8_t port, int flags);
+#if FUOTA_STORAGE_PRESENT
+static void frag_port_handler(const uint8_t *buffer, uint8_t size, uint8_t port, int flags);
+#endif
+
+// Blocking delay, ThisThread is not available in bare-metal (no RTOS) builds
+static void app_sleep_ms(uint32_t ms)
+{
+#if MBED_CONF_RTOS_PRESENT
+    ThisThread::sleep_for(ms);
+#else
+    wait_ms(ms);
+#endif
+}
+
 const char* get_device_class_string(device_class_t device_class)
 {
     switch(device_class)
@@ -127,6 +259,17 @@ const char* get_device_class_string(device_class_t device_class)
     }
 }
 
+// Application state flags stored with each trace record
+static uint8_t app_trace_flags()
+{
+    return (app_device_class & 0x03) |
+           (class_b_on ? TRACE_FLAG_CLASS_B_ON : 0) |
+           (beacon_acq_enabled ? TRACE_FLAG_BEACON_ACQ : 0) |
+           (ping_slot_synched ? TRACE_FLAG_PING_SLOT_SYNCHED : 0) |
+           (device_time_synched ? TRACE_FLAG_TIME_SYNCHED : 0) |
+           (beacon_found ? TRACE_FLAG_BEACON_FOUND : 0);
+}
+
 bool serial_rx_irq_enable = true;
 
 bool atoh(uint8_t &hex, char high_nibble, char low_nibble)
@@ -145,10 +288,53 @@ bool atoh(uint8_t &hex, char high_nibble, char low_nibble)
     return true;
 }
 
+// Commands change the stack and application state so they run on the radio queue
+static void run_serial_commands()
+{
+    command_msg_t msg;
+
+    while(command_mailbox.get(msg))
+    {
+        event_trace_record(TRACE_TYPE_SERIAL_COMMAND, msg.data[0], (msg.size >= 2) ? msg.data[1] : 0, app_trace_flags());
+        receive_command(msg.data, msg.size, false);
+    }
+}
+
+static void post_serial_command(const uint8_t *buffer, uint8_t size)
+{
+    command_msg_t msg;
+
+    memcpy(msg.data, buffer, size);
+    msg.size = size;
+
+    if(command_mailbox.put(msg))
+        ev_queue.call(run_serial_commands);
+    else
+        printf("Command dropped, radio queue busy\n");
+}
+
+// Decode the hex digits in the Rx buffer into serial_command, size has to be a multiple of two
+static bool decode_serial_command(uint8_t size)
+{
+    bool is_valid = true;
+
+    for(uint16_t i=0; i < size && is_valid; i+=2) 
+    {
+        char hn, ln;
+
+        if(serial_rx_buffer.pop(hn) && serial_rx_buffer.pop(ln))
+            is_valid = atoh(serial_command[i/2], hn, ln);
+        else
+            is_valid = false;
+    }
+
+    return is_valid;
+}
+
 void receive_serial_command()
 {
     uint8_t  size = serial_rx_buffer.size();
-    bool     is_valid = true;
+    bool     is_valid;
 
     if(size == 1)
     {
@@ -159,22 +345,97 @@ void receive_serial_command()
             display_app_info();
             display_command_help();
         }
+        else if(c == 'p')
+        {
+            power_print_stats(console_attached);
+        }
+        else if(c == 'r')
+        {
+            port_router_print_stats();
+        }
+        else if(c == 'b')
+        {
+            beacon_history_print();
+        }
+#if MBED_CONF_APP_PERF_BENCHMARKS
+        else if(c == 'P')
+        {
+            // The benchmarks use the radio side state
+            ev_queue.call(run_benchmarks);
+        }
+#endif
+        else if(c == 'a')
+        {
+            adr_assist_print_stats(app_tx_interval);
+        }
+        else if(c == 'e')
+        {
+            energy_print_stats();
+        }
+        else if(c == 'k')
+        {
+            persist_print_stats();
+        }
+        else if(c == 'd')
+        {
+            trace_filter_print_stats();
+        }
+        else if(c == 'q')
+        {
+            queue_probe_print(&radio_probe);
+            queue_probe_print(&console_probe);
+            printf("Mailbox drops command=%lu persist=%lu\n", command_mailbox.dropped(), persist_mailbox.dropped());
+#if FUOTA_STORAGE_PRESENT
+            printf("Mailbox drops fragment=%lu answer=%lu\n", frag_mailbox.dropped(), frag_answer_mailbox.dropped());
+#endif
+#if MBED_CONF_RTOS_PRESENT
+            printf("Log drops %lu bytes\n", log_console.dropped());
+#endif
+        }
+#if MBED_CONF_APP_RADIO_TIMING
+        else if(c == 'l')
+        {
+            radio.print_stats();
+        }
+#endif
+#if (MBED_CONF_APP_LORA_RADIO == SIM) && !MBED_CONF_APP_RADIO_TIMING
+        else if(c == 's')
+        {
+            radio.print_stats();
+        }
+#endif
+#if SIM_NETWORK_SERVER
+        else if(c == 'n')
+        {
+            ns_emu_print_stats();
+        }
+#endif
+        else if(c == 't')
+        {
+            event_trace_dump();
+        }
+        else if(c == 'T')
+        {
+            event_trace_dump_saved();
+        }
+        else if(c == 'w')
+        {
+            printf("Save event trace. ");
+            print_return_code(event_trace_save(), MBED_SUCCESS);
+        }
+#if FUOTA_STORAGE_PRESENT
+        else if(c == 'f')
+        {
+            frag_session_print_status();
+        }
+#endif
     }
     else
     {
-        // size has to be a multiple of two
-        for(uint16_t i=0; i < size && is_valid; i+=2) 
-        {
-            char hn, ln;
-
-            if(serial_rx_buffer.pop(hn) && serial_rx_buffer.pop(ln))
-                is_valid = atoh(serial_command[i/2], hn, ln);
-            else
-                is_valid = false;
-        }
+        is_valid = decode_serial_command(size);
 
-        if(is_valid)
-            receive_command(serial_command, size/2);
+        if(is_valid && (size >= 2))
+            post_serial_command(serial_command, size/2);
     }
 
     if(!serial_rx_buffer.empty())
@@ -182,6 +443,7 @@ void receive_serial_command()
 
 
     serial_rx_irq_enable = true;
+    console_restart_idle_timer();
 }
 
 void serial_rx_irq()
@@ -208,27 +470,274 @@ void serial_rx_irq()
             if(eol || serial_rx_buffer.full())
             {
                 serial_rx_irq_enable = false;
-                ev_queue.call(receive_serial_command);
+                console_queue.call(receive_serial_command);
             }
         }
     }
 }
 
+#if MBED_CONF_APP_LOW_POWER
+static void console_wake_irq(uint32_t id, gpio_irq_event event)
+{
+    gpio_irq_disable(&console_wake);
+    console_queue.call(console_attach);
+}
+
+// Detach the serial Rx interrupt so the MCU can enter deep sleep. The Rx pin becomes
+// a GPIO interrupt, the start bit of the next character re-attaches the console.
+// That character is lost.
+static void console_release()
+{
+    gpio_t rx_pin;
+
+    console_idle_event = 0;
+
+    if(!console_attached)
+        return;
+
+    printf("Console released, send any character to re-attach\n");
+    pc.attach(mbed::Callback<void()>(), Serial::RxIrq);
+    console_attached = false;
+
+    gpio_irq_init(&console_wake, USBRX, console_wake_irq, 0);
+    gpio_init_in(&rx_pin, USBRX);
+    gpio_irq_set(&console_wake, IRQ_FALL, 1);
+    gpio_irq_enable(&console_wake);
+    console_wake_armed = true;
+}
+#endif
+
+static void console_restart_idle_timer()
+{
+#if MBED_CONF_APP_LOW_POWER
+    if(console_idle_event)
+        console_queue.cancel(console_idle_event);
+
+    console_idle_event = console_queue.call_in(MBED_CONF_APP_CONSOLE_IDLE_TIMEOUT, console_release);
+#endif
+}
+
+static void console_attach()
+{
+    if(!console_attached)
+    {
+#if MBED_CONF_APP_LOW_POWER
+        // Hand the Rx pin back to the UART
+        if(console_wake_armed)
+        {
+            gpio_irq_free(&console_wake);
+            pinmap_pinout(USBRX, serial_rx_pinmap());
+            console_wake_armed = false;
+        }
+#endif
+        pc.attach(mbed::callback(serial_rx_irq), Serial::RxIrq);
+        console_attached = true;
+    }
+
+    console_restart_idle_timer();
+}
+
+// Application uplink: beacon lock, beacon miss and received message counters, big endian.
+// When max_size allows, the data rate of the previous uplink and the uplink interval
+// in seconds follow
+static uint8_t pack_uplink_payload(uint8_t *buffer, uint8_t max_size)
+{
+    buffer[0] = (app_data.beacon_lock >> 8) & 0xff;
+    buffer[1] = app_data.beacon_lock & 0xff;
+    buffer[2] = (app_data.beacon_miss >> 8) & 0xff;
+    buffer[3] = app_data.beacon_miss & 0xff;
+    buffer[4] = (app_data.rx >> 8) & 0xff;
+    buffer[5] = app_data.rx & 0xff;
+
+    if(max_size < APP_PAYLOAD_MAX_SIZE)
+        return APP_PAYLOAD_SIZE;
+
+    uint32_t interval = adr_assist_interval(app_tx_interval);
+
+    buffer[6] = adr_assist_data_rate();
+    buffer[7] = (interval > 0xffff) ? 0xff : (interval >> 8) & 0xff;
+    buffer[8] = (interval > 0xffff) ? 0xff : interval & 0xff;
+
+    return APP_PAYLOAD_MAX_SIZE;
+}
+
+// Messages waiting in the application mailboxes, part of the watchdog post-mortem
+static uint8_t app_queue_depth()
+{
+    uint8_t depth = command_mailbox.count() + persist_mailbox.count();
+
+#if FUOTA_STORAGE_PRESENT
+    depth += frag_mailbox.count();
+#endif
+    return depth;
+}
+
+// Counters continue over the resets made by the firmware, see boot_helper.h
+static void prepare_reset()
+{
+    boot_save_state(&app_data, sizeof(app_data));
+    boot_prepare_reset();
+}
+
+// Deep sleep lock holders known to the application, see power_helper.h
+static bool console_holds_deep_sleep()
+{
+    return console_attached;
+}
+
+// The radio drivers arm a Timeout, which locks deep sleep, while TX or RX is running
+static bool radio_holds_deep_sleep()
+{
+    return radio.get_status() != RF_IDLE;
+}
+
+static bool credential_set(const uint8_t *value, uint8_t size)
+{
+    for(uint8_t i = 0; i < size; i++)
+    {
+        if(value[i] != 0)
+            return true;
+    }
+
+    return false;
+}
+
+// Settings, provisioned credentials and counters, see config_snapshot_helper.h
+static void collect_config_snapshot(config_snapshot_t &snapshot)
+{
+    snapshot.version[0]            = MAJOR_VERSION;
+    snapshot.version[1]            = MINOR_VERSION;
+    snapshot.version[2]            = PATCH_VERSION;
+    snapshot.tx_interval           = (app_tx_interval > 0xffff) ? 0xffff : app_tx_interval;
+    snapshot.confirmed             = (tx_flags == MSG_CONFIRMED_FLAG) ? 1 : 0;
+    snapshot.adr_on                = adr_on;
+    snapshot.device_class          = app_device_class;
+    snapshot.ping_slot_periodicity = ping_slot_periodicity;
+    snapshot.trace_level           = trace_filter_get_level();
+    snapshot.trace_groups          = trace_filter_get_groups();
+    snapshot.credentials           = (use_builtin_deveui ? 0 : CONFIG_CREDENTIAL_DEV_EUI) |
+                                     (credential_set(APP_EUI, sizeof(APP_EUI)) ? CONFIG_CREDENTIAL_APP_EUI : 0) |
+                                     (credential_set(APP_KEY, sizeof(APP_KEY)) ? CONFIG_CREDENTIAL_APP_KEY : 0);
+    snapshot.rx                    = app_data.rx;
+    snapshot.beacon_lock           = app_data.beacon_lock;
+    snapshot.beacon_miss           = app_data.beacon_miss;
+}
+
+// Print the snapshot as the serial command importing it
+static void print_config_snapshot()
+{
+    config_snapshot_t snapshot;
+    uint8_t buffer[CONFIG_SNAPSHOT_SIZE];
+
+    collect_config_snapshot(snapshot);
+    printf("CONFIG-SNAPSHOT %02x", SET_CONFIG_SNAPSHOT);
+    config_snapshot_print(buffer, config_snapshot_pack(snapshot, buffer));
+    printf("\n");
+}
+
+// Snapshot requested by a downlink, sent by the next uplink
+static bool config_export_requested = false;
+
+// Send the requested config snapshot, returns false when there is none
+static bool send_config_snapshot()
+{
+    config_snapshot_t snapshot;
+    uint8_t buffer[CONFIG_SNAPSHOT_SIZE];
+    uint8_t size;
+
+    if(!config_export_requested)
+        return false;
+
+    config_export_requested = false;
+    collect_config_snapshot(snapshot);
+    size = config_snapshot_pack(snapshot, buffer);
+
+    if(size > adr_assist_max_payload())
+    {
+        printf("Config snapshot needs %u bytes, the data rate allows %u\n", size, adr_assist_max_payload());
+        return false;
+    }
+
+    printf("Sending %u bytes config snapshot\n", size);
+    int16_t retcode = lorawan.send(MBED_CONF_APP_DIAG_PORT, buffer, size, MSG_UNCONFIRMED_FLAG);
+    if (retcode < 0) {
+        printf("send() config snapshot - Error code %d\n", retcode);
+        queue_next_send_message();
+        return true;
+    }
+
+    adr_assist_sent(size);
+    return true;
+}
+
+// Send the watchdog post-mortem of the previous run, returns false when there is none
+static bool send_watchdog_report()
+{
+    uint8_t report[WATCHDOG_REPORT_SIZE];
+    uint8_t size = watchdog_report(report, sizeof(report));
+
+    if(size == 0)
+        return false;
+
+    printf("Sending %u bytes watchdog report\n", size);
+    int16_t retcode = lorawan.send(MBED_CONF_APP_DIAG_PORT, report, size, MSG_UNCONFIRMED_FLAG);
+    if (retcode < 0) {
+        printf("send() watchdog report - Error code %d\n", retcode);
+        queue_next_send_message();
+        return true;
+    }
+
+    adr_assist_sent(size);
+    watchdog_report_sent();
+    return true;
+}
+
+// Send the energy estimate when due, returns false when it is not
+static bool send_energy_report()
+{
+    uint8_t report[ENERGY_REPORT_SIZE];
+    uint8_t size;
+
+    if(!energy_report_due())
+        return false;
+
+    size = energy_report(report, sizeof(report));
+    printf("Sending %u bytes energy report\n", size);
+    int16_t retcode = lorawan.send(MBED_CONF_APP_DIAG_PORT, report, size, MSG_UNCONFIRMED_FLAG);
+    if (retcode < 0) {
+        printf("send() energy report - Error code %d\n", retcode);
+        queue_next_send_message();
+        return true;
+    }
+
+    adr_assist_sent(size);
+    energy_report_sent();
+    return true;
+}
 
 // Send a message over LoRaWAN
 static void send_message()
 {
+    WatchdogScope watchdog_scope(WATCHDOG_HANDLER_SEND, MBED_CONF_APP_WATCHDOG_HANDLER_DEADLINE);
+
     send_queued = 0;
 
-    uint8_t tx_buffer[6];
-    tx_buffer[0] = (app_data.beacon_lock >> 8) & 0xff;
-    tx_buffer[1] = app_data.beacon_lock & 0xff;
-    tx_buffer[2] = (app_data.beacon_miss >> 8) & 0xff;
-    tx_buffer[3] = app_data.beacon_miss & 0xff;
-    tx_buffer[4] = (app_data.rx >> 8) & 0xff;
-    tx_buffer[5] = app_data.rx & 0xff;
+    // The first uplink after a stall reports it
+    if(send_watchdog_report())
+        return;
+
+    if(send_config_snapshot())
+        return;
 
-    int packet_len = sizeof(tx_buffer);
+    // Takes the place of one regular uplink every energy-report-interval
+    if(send_energy_report())
+        return;
+
+    uint8_t tx_buffer[APP_PAYLOAD_MAX_SIZE];
+
+    // The payload follows the data rate ADR selected for the previous uplink
+    int packet_len = pack_uplink_payload(tx_buffer, adr_assist_max_payload());
+    boot_save_state(&app_data, sizeof(app_data));
     printf("Sending %d bytes\n", packet_len);
 
     int16_t retcode = lorawan.send(MBED_CONF_APP_LORA_UPLINK_PORT, tx_buffer, packet_len,tx_flags); 
@@ -241,13 +750,35 @@ static void send_message()
         return;
     }
 
+    adr_assist_sent(retcode);
     printf("%d bytes scheduled for transmission\n", retcode);
 }
 
+#if MBED_CONF_APP_UPLINK_SLOTTING
+// Delay until the next uplink slot of this device, anchored to GPS time once Class B is on
+static int slotted_interval_ms(int interval_ms)
+{
+    int delay = interval_ms;
+
+    if(class_b_on)
+    {
+        uint64_t gps_time = lorawan.get_current_gps_time();
+
+        if(gps_time != 0)
+            delay = uplink_slot_gps_delay_ms(gps_time, interval_ms);
+    }
+
+    delay += uplink_slot_jitter_ms(interval_ms);
+
+    return (delay < MIN_TX_INTERVAL*1000) ? MIN_TX_INTERVAL*1000 : delay;
+}
+#endif
+
 static void queue_next_send_message()
 {
     int backoff;
-    int txInterval = fastTransmit ? MIN_TX_INTERVAL : app_tx_interval;
+    // Stretched when the data rate drops, see adr_assist_helper.h
+    int txInterval = fastTransmit ? MIN_TX_INTERVAL : adr_assist_interval(app_tx_interval);
 
     if (send_queued) {
         return;
@@ -256,6 +787,10 @@ static void queue_next_send_message()
     lorawan.get_backoff_metadata(backoff);
     if(backoff < txInterval){
         backoff = txInterval*1000;
+#if MBED_CONF_APP_UPLINK_SLOTTING
+        if(!fastTransmit)
+            backoff = slotted_interval_ms(backoff);
+#endif
     }
 
     printf("Next uplink in %d seconds\r\n", backoff / 1000);
@@ -276,21 +811,242 @@ void print_return_code(int rc, int expected_rc)
         printf("(expected %d!).\n",expected_rc);
 }
 
-void restore_config()
+// A KVStore write can stall for a flash erase, settings are written from the console queue
+static void persist_settings()
 {
-    uint32_t value;
-    uint16_t size;
+    persist_msg_t msg;
+    int rc;
+
+    while(persist_mailbox.get(msg))
+    {
+        if(msg.key)
+        {
+            printf("Save %s. ", msg.key);
+            rc = persist_write(msg.key, msg.value, msg.size);
+        }
+        else
+        {
+            printf("Reset NVStore. ");
+            rc = persist_reset();
+        }
+        print_return_code(rc, MBED_SUCCESS);
+    }
+}
+
+// Set while an import is applied, its settings are written together by persist_config_import()
+static bool config_import_applying = false;
+
+// Result of the last receive_command(), not LORAWAN_STATUS_OK when the stack refused a setting
+static int  command_status = LORAWAN_STATUS_OK;
+
+static void persist_setting(const char *key, const void *value, uint8_t size)
+{
+    persist_msg_t msg;
+
+    if(config_import_applying)
+        return;
+
+    MBED_ASSERT(size <= sizeof(msg.value));
+    msg.key  = key;
+    msg.size = size;
+    if(value)
+        memcpy(msg.value, value, size);
+
+    if(persist_mailbox.put(msg))
+        console_queue.call(persist_settings);
+    else
+        printf("Save %s dropped, console queue busy\n", key ? key : "reset");
+}
+
+// Write the settings of a snapshot in the format restore_config() reads
+static int write_config_snapshot(const config_snapshot_t &snapshot)
+{
+    uint32_t interval = snapshot.tx_interval;
+    int      result = MBED_SUCCESS;
+    int      rc[7];
+
+    rc[0] = persist_write(NVSTORE_TX_INTERVAL_KEY, &interval, sizeof(interval));
+    rc[1] = persist_write(NVSTORE_UPLINK_MSGTYPE_KEY, &snapshot.confirmed, 1);
+    rc[2] = persist_write(NVSTORE_ADR_ON_KEY, &snapshot.adr_on, 1);
+    rc[3] = persist_write(NVSTORE_DEVICE_CLASS_KEY, &snapshot.device_class, 1);
+    rc[4] = persist_write(NVSTORE_PING_SLOT_PERIODICITY, &snapshot.ping_slot_periodicity, 1);
+    rc[5] = persist_write(NVSTORE_TRACE_LEVEL_KEY, &snapshot.trace_level, 1);
+    rc[6] = persist_write(NVSTORE_TRACE_GROUPS_KEY, &snapshot.trace_groups, sizeof(snapshot.trace_groups));
+
+    for(uint8_t i = 0; i < 7; i++)
+    {
+        if(rc[i] != MBED_SUCCESS)
+            result = rc[i];
+    }
+
+    return result;
+}
+
+// Imported snapshot waiting for persist_config_import(), radio queue -> console queue
+static uint8_t       config_import[CONFIG_SNAPSHOT_SIZE];
+static volatile bool config_import_pending = false;
+
+// The journal keeps the import atomic over a reset, see config_snapshot_helper.h
+static void persist_config_import()
+{
+    config_snapshot_t snapshot;
     int rc;
-    size_t actual_size;
 
-    rc = kv_get(NVSTORE_TX_INTERVAL_KEY, &value, sizeof(value), &actual_size);
+    printf("Save config snapshot. ");
+    config_snapshot_unpack(config_import, sizeof(config_import), snapshot);
+    rc = config_snapshot_journal_save(config_import);
     if(rc == MBED_SUCCESS)
+    {
+        rc = write_config_snapshot(snapshot);
+        if(rc == MBED_SUCCESS)
+            rc = config_snapshot_journal_clear();
+    }
+    print_return_code(rc, MBED_SUCCESS);
+
+    config_import_pending = false;
+}
+
+static bool check_config_snapshot(const config_snapshot_t &snapshot)
+{
+    return (snapshot.tx_interval >= MIN_TX_INTERVAL) && (snapshot.confirmed <= 1) && (snapshot.adr_on <= 1) && (snapshot.device_class <= 2) &&
+           (snapshot.ping_slot_periodicity <= PING_SLOT_PERIODICITY_MAX) &&
+           (snapshot.trace_level <= TRACE_FILTER_LEVEL_MAX);
+}
+
+// A setting of an import as a single setting command, and the command that puts the current value back
+typedef struct {
+    uint8_t command[3];
+    uint8_t undo[3];
+    uint8_t size;
+} config_import_step_t;
+
+static uint8_t add_import_step(config_import_step_t *steps, uint8_t count, uint8_t opcode, uint16_t value,
+                               uint16_t current, bool wide)
+{
+    config_import_step_t &step = steps[count];
+
+    step.command[0] = step.undo[0] = opcode;
+    if(wide)
+    {
+        step.command[1] = value >> 8;
+        step.command[2] = value & 0xff;
+        step.undo[1]    = current >> 8;
+        step.undo[2]    = current & 0xff;
+        step.size       = 3;
+    }
+    else
+    {
+        step.command[1] = value;
+        step.undo[1]    = current;
+        step.size       = 2;
+    }
+
+    return count + 1;
+}
+
+// Applied sub-commands are traced like the command itself, the replay sees each setting change
+static int run_import_command(const uint8_t *command, uint8_t size, bool downlink)
+{
+    event_trace_record(downlink ? TRACE_TYPE_DOWNLINK_COMMAND : TRACE_TYPE_SERIAL_COMMAND, command[0], command[1],
+        app_trace_flags());
+    receive_command(command, size, downlink);
+
+    return command_status;
+}
+
+// Validate the whole snapshot before anything is applied, the settings that differ
+// go through the handlers of the single setting commands. The settings are only
+// persisted when every step succeeds, otherwise the applied steps are undone.
+static void import_config_snapshot(const uint8_t *buffer, uint8_t size, bool downlink)
+{
+    config_snapshot_t    snapshot;
+    config_snapshot_t    current;
+    config_import_step_t steps[7];
+    int                  results[7];
+    uint8_t              count = 0;
+    uint8_t              applied;
+
+    if(!config_snapshot_unpack(buffer, size, snapshot) || !check_config_snapshot(snapshot))
+    {
+        printf("Config snapshot rejected, invalid\n");
+        return;
+    }
+
+    if(config_import_pending)
+    {
+        printf("Config snapshot rejected, previous import not saved yet\n");
+        return;
+    }
+
+    printf("Import config snapshot of version %u.%u.%u\n", snapshot.version[0], snapshot.version[1], snapshot.version[2]);
+    collect_config_snapshot(current);
+
+    if(snapshot.tx_interval != current.tx_interval)
+        count = add_import_step(steps, count, SET_TX_INTERVAL, snapshot.tx_interval, current.tx_interval, true);
+    if(snapshot.confirmed != current.confirmed)
+        count = add_import_step(steps, count, SET_UPLINK_MSGTYPE, snapshot.confirmed, current.confirmed, false);
+    if(snapshot.adr_on != current.adr_on)
+        count = add_import_step(steps, count, SET_ADR_STATE, snapshot.adr_on, current.adr_on, false);
+    if(snapshot.trace_level != current.trace_level)
+        count = add_import_step(steps, count, SET_TRACE_LEVEL, snapshot.trace_level, current.trace_level, false);
+    if(snapshot.trace_groups != current.trace_groups)
+        count = add_import_step(steps, count, SET_TRACE_GROUPS, snapshot.trace_groups, current.trace_groups, true);
+    if(snapshot.ping_slot_periodicity != current.ping_slot_periodicity)
+        count = add_import_step(steps, count, SET_PING_SLOT_PERIODICITY, snapshot.ping_slot_periodicity,
+            current.ping_slot_periodicity, false);
+    // Last, a class change can start an uplink
+    if(snapshot.device_class != current.device_class)
+        count = add_import_step(steps, count, SET_DEVICE_CLASS, snapshot.device_class, current.device_class, false);
+
+    config_import_applying = true;
+
+    for(applied = 0; applied < count; applied++)
+    {
+        results[applied] = run_import_command(steps[applied].command, steps[applied].size, downlink);
+        if(results[applied] != LORAWAN_STATUS_OK)
+            break;
+    }
+
+    if(applied < count)
+    {
+        printf("Config snapshot import failed at command %02x, result %d, rolling back %u commands\n",
+            steps[applied].command[0], results[applied], applied + 1);
+
+        // The failed step is undone too, its handler can have changed the setting before the stack refused it
+        for(int i = applied; i >= 0; i--)
+        {
+            int rc = run_import_command(steps[i].undo, steps[i].size, downlink);
+            if(rc != LORAWAN_STATUS_OK)
+                printf("Rollback of command %02x failed, result %d\n", steps[i].undo[0], rc);
+        }
+    }
+
+    config_import_applying = false;
+
+    if(applied == count)
+    {
+        printf("Config snapshot import applied %u commands\n", count);
+        memcpy(config_import, buffer, size);
+        config_import_pending = true;
+        if(!console_queue.call(persist_config_import))
+        {
+            config_import_pending = false;
+            printf("Save config snapshot dropped, console queue busy\n");
+        }
+    }
+}
+
+void restore_config()
+{
+    uint32_t value;
+    config_snapshot_t snapshot;
+
+    if(persist_restore(NVSTORE_TX_INTERVAL_KEY, value))
     {
         app_tx_interval = value;
     }
 
-    rc = kv_get(NVSTORE_ADR_ON_KEY, &value, sizeof(value), &actual_size);
-    if(rc == MBED_SUCCESS)
+    if(persist_restore(NVSTORE_ADR_ON_KEY, value))
     {
         if(value <= 1)
             adr_on = value; 
@@ -298,8 +1054,7 @@ void restore_config()
             printf("restore() - invalid ADR=%lu\n", value);
     }
 
-    rc = kv_get(NVSTORE_UPLINK_MSGTYPE_KEY, &value, sizeof(value), &actual_size);
-    if(rc == MBED_SUCCESS)
+    if(persist_restore(NVSTORE_UPLINK_MSGTYPE_KEY, value))
     {
         if(value <= 1)
             tx_flags = (value == 0) ? MSG_UNCONFIRMED_FLAG :  MSG_CONFIRMED_FLAG;
@@ -307,8 +1062,7 @@ void restore_config()
             printf("restore() - invalid uplink type=%lu\n", value);
     }
 
-    rc = kv_get(NVSTORE_DEVICE_CLASS_KEY, &value, sizeof(value), &actual_size);
-    if(rc == MBED_SUCCESS)
+    if(persist_restore(NVSTORE_DEVICE_CLASS_KEY, value))
     {
         if(value <= 2)
             app_device_class = static_cast<device_class_t>(value);
@@ -316,15 +1070,42 @@ void restore_config()
             printf("restore() - invalid device class=%lu\n", value);
     }
 
-    rc = kv_get(NVSTORE_PING_SLOT_PERIODICITY, &value, sizeof(value), &actual_size);
-    if(rc == MBED_SUCCESS)
+    if(persist_restore(NVSTORE_PING_SLOT_PERIODICITY, value))
     {
-        printf("restore() - ping slot periodicity=%lu\n", value);
         if(value <= PING_SLOT_PERIODICITY_MAX)
             ping_slot_periodicity = value; 
         else
             printf("restore() - invalid ping slot periodicity=%lu\n", value);
     }
+
+    if(persist_restore(NVSTORE_TRACE_LEVEL_KEY, value))
+    {
+        if(!trace_filter_set_level(value))
+            printf("restore() - invalid trace level=%lu\n", value);
+    }
+
+    if(persist_restore(NVSTORE_TRACE_GROUPS_KEY, value))
+    {
+        trace_filter_set_groups(value);
+    }
+
+    // An import cut short by a reset is completed
+    if(config_snapshot_journal_load(snapshot) && check_config_snapshot(snapshot))
+    {
+        printf("Complete config snapshot import. ");
+        app_tx_interval       = snapshot.tx_interval;
+        tx_flags              = snapshot.confirmed ? MSG_CONFIRMED_FLAG : MSG_UNCONFIRMED_FLAG;
+        adr_on                = snapshot.adr_on;
+        app_device_class      = static_cast<device_class_t>(snapshot.device_class);
+        ping_slot_periodicity = snapshot.ping_slot_periodicity;
+        trace_filter_set_level(snapshot.trace_level);
+        trace_filter_set_groups(snapshot.trace_groups);
+
+        int rc = write_config_snapshot(snapshot);
+        if(rc == MBED_SUCCESS)
+            rc = config_snapshot_journal_clear();
+        print_return_code(rc, MBED_SUCCESS);
+    }
 }
 
 void display_command_help()
@@ -339,10 +1120,44 @@ void display_command_help()
     printf("Set Ping Slot Periodicity  %02x + [00 - 07]\n", SET_PING_SLOT_PERIODICITY);
     printf("Send LinkCheckReq          %02x\n", SEND_LINK_CHECK_REQ);
     printf("Send DeviceTimeReq         %02x\n", SEND_DEVICE_TIME_REQ);
+    printf("Set Trace Level            %02x + [none=00, error=01, warn=02, info=03, debug=04]\n", SET_TRACE_LEVEL);
+    printf("Set Trace Groups           %02x + [group mask encoded in 2 bytes, bit set = group on]\n", SET_TRACE_GROUPS);
+    printf("Export Config Snapshot     %02x\n", GET_CONFIG_SNAPSHOT);
+    printf("Import Config Snapshot     %02x + [%u byte snapshot from export]\n", SET_CONFIG_SNAPSHOT, CONFIG_SNAPSHOT_SIZE);
     printf("Reset Persistent Settings  %02x\n", RESET_NONVOL_CMD);
     printf("Device Reset               %02x\n", SW_RESET_CMD);
+    printf("Display Info               ?\n");
+    printf("Display Power Stats        p\n");
+    printf("Display Downlink Routes    r\n");
+    printf("Display Beacon History     b\n");
+    printf("Display Queue Latency      q\n");
+    printf("Display Trace Cost         d\n");
+    printf("Display Settings Writes    k\n");
+    printf("Display Data Rate Stats    a\n");
+    printf("Display Energy Estimate    e\n");
+#if MBED_CONF_APP_PERF_BENCHMARKS
+    printf("Run Benchmarks (JSON)      P\n");
+#endif
+#if MBED_CONF_APP_RADIO_TIMING
+    printf("Display RX Window Timing   l\n");
+#endif
+#if (MBED_CONF_APP_LORA_RADIO == SIM) && !MBED_CONF_APP_RADIO_TIMING
+    printf("Display Simulated Radio    s\n");
+#endif
+#if SIM_NETWORK_SERVER
+    printf("Display Network Server     n\n");
+#endif
+    printf("Dump Event Trace           t\n");
+    printf("Save Event Trace           w\n");
+    printf("Dump Saved Event Trace     T\n");
+#if FUOTA_STORAGE_PRESENT
+    printf("Display FUOTA Session      f\n");
+#endif
 
     printf("\nLoRaWAN Command FPort=%d\n", MBED_CONF_APP_LORA_CONFIG_PORT);
+#if FUOTA_STORAGE_PRESENT
+    printf("LoRaWAN Fragmentation FPort=%d\n", FRAG_PORT);
+#endif
     printf("--------------------------------------------------------------\n\n");
 }
 
@@ -376,23 +1191,244 @@ void display_app_info()
 
     printf("Beacon Acquisition    : %s\n", beacon_acq_enabled ? "on": "off");
     printf("Tx Interval           : %lu\n", app_tx_interval);
-    printf("ADR                   : %u\n", adr_on);
+    printf("ADR                   : %u, airtime budget %u ms/hour\n", adr_on, ADR_ASSIST_AIRTIME_BUDGET);
     printf("Msg Type              : %u\n", tx_flags);
     printf("Ping Slot Periodicity : %u\n", ping_slot_periodicity); 
+    printf("Low Power             : %s\n", MBED_CONF_APP_LOW_POWER ? "on" : "off");
+    boot_print_stats();
+    printf("Watchdog              : %u ms, handler deadline %u ms, report FPort=%u\n",
+        WATCHDOG_TIMEOUT_MS, MBED_CONF_APP_WATCHDOG_HANDLER_DEADLINE, MBED_CONF_APP_DIAG_PORT);
+    printf("Energy Report         : every %lu s, FPort=%u\n", (uint32_t)ENERGY_REPORT_INTERVAL, MBED_CONF_APP_DIAG_PORT);
+    printf("Uplink Slotting       : %s", MBED_CONF_APP_UPLINK_SLOTTING ? "on" : "off");
+#if MBED_CONF_APP_UPLINK_SLOTTING
+    printf(" (phase=%lu ms, jitter=%u%%)", uplink_slot_phase_ms(app_tx_interval * 1000), UPLINK_SLOT_JITTER_PCT);
+#endif
+    printf("\n");
     printf("\n\n");
 }
 
+#if MBED_CONF_APP_PERF_BENCHMARKS
+#define PERF_KVSTORE_SIZE       4096
+#define PERF_KVSTORE_ERASE_SIZE 512
+
+static volatile uint32_t perf_sink;
+
+#if FUOTA_STORAGE_PRESENT
+#define PERF_FRAG_NB            512     // 100 KB image
+#define PERF_FRAG_SIZE          200
+
+static uint8_t  perf_frag_msg[FRAG_MAX_SIZE + 3];
+static uint8_t  perf_frag_tmp[FRAG_MAX_SIZE];
+static uint8_t  perf_frag_row[FRAG_BITMAP_BYTES(FRAG_MAX_NB)];
+static uint32_t perf_frag_session_ms;
+static uint32_t perf_frag_decode_ms;
+
+// Content of uncoded fragment index of the benchmark image
+static void perf_frag_fill(uint16_t index, uint8_t *data)
+{
+    for(uint8_t i = 0; i < PERF_FRAG_SIZE; i++)
+        data[i] = (uint8_t)(index * 31 + i * 7 + (index >> 8));
+}
+
+static void perf_frag_process(const uint8_t *buffer, uint8_t size, Timer &timer)
+{
+    uint8_t answer[16];
+
+    timer.start();
+    frag_session_process(buffer, size, false, answer, sizeof(answer));
+    timer.stop();
+}
+
+// A 100 KB FUOTA session on the FUOTA block device with a fixed loss pattern, every
+// tenth uncoded and every fifth coded fragment is lost. Only the fragmentation
+// session is timed, not the encoding. This erases the FUOTA storage, a session in
+// progress is left alone
+static bool perf_frag_decode()
+{
+    static const uint8_t setup[] = { FRAG_SESSION_SETUP_REQ, 0x00, PERF_FRAG_NB & 0xff, PERF_FRAG_NB >> 8,
+                                     PERF_FRAG_SIZE, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    static const uint8_t remove[] = { FRAG_SESSION_DELETE_REQ, 0x00 };
+    uint8_t *data   = perf_frag_msg + 3;
+    uint32_t errors = 0;
+    bool     ok;
+    Timer    timer;
+
+    if((frag_session.state != FRAG_SESSION_IDLE) || (frag_mailbox.count() > 0))
+        return false;
+
+    perf_frag_process(setup, sizeof(setup), timer);
+
+    perf_frag_msg[0] = FRAG_DATA_FRAGMENT;
+    for(uint16_t index = 0; index < PERF_FRAG_NB; index++)
+    {
+        if(index % 10 == 3)
+            continue;
+        perf_frag_msg[1] = (index + 1) & 0xff;
+        perf_frag_msg[2] = (index + 1) >> 8;
+        perf_frag_fill(index, data);
+        perf_frag_process(perf_frag_msg, PERF_FRAG_SIZE + 3, timer);
+    }
+
+    for(uint16_t n = 1; (n <= 2 * FRAG_MAX_REDUNDANCY) && (frag_session.state == FRAG_SESSION_ACTIVE); n++)
+    {
+        if(n % 5 == 0)
+            continue;
+        frag_parity_row(n, PERF_FRAG_NB, perf_frag_row);
+        memset(data, 0, PERF_FRAG_SIZE);
+        for(uint16_t index = 0; index < PERF_FRAG_NB; index++)
+        {
+            if(frag_bit_get(perf_frag_row, index))
+            {
+                perf_frag_fill(index, perf_frag_tmp);
+                frag_xor(data, perf_frag_tmp, PERF_FRAG_SIZE);
+            }
+        }
+        perf_frag_msg[1] = (PERF_FRAG_NB + n) & 0xff;
+        perf_frag_msg[2] = (PERF_FRAG_NB + n) >> 8;
+        perf_frag_process(perf_frag_msg, PERF_FRAG_SIZE + 3, timer);
+    }
+
+    // The recovered image must match what was sent
+    for(uint16_t index = 0; (index < PERF_FRAG_NB) && (frag_session.state == FRAG_SESSION_COMPLETE); index++)
+    {
+        perf_frag_fill(index, data);
+        if((frag_storage_read(frag_image_addr(index), perf_frag_tmp, PERF_FRAG_SIZE) != 0) ||
+           (memcmp(data, perf_frag_tmp, PERF_FRAG_SIZE) != 0))
+            errors++;
+    }
+
+    ok = (frag_session.state == FRAG_SESSION_COMPLETE) && (errors == 0);
+    if(!ok)
+        printf("FUOTA benchmark - decode failed, %lu fragments differ\n", errors);
+
+    perf_frag_session_ms = timer.read_ms();
+    perf_frag_decode_ms  = frag_session.decode_time_us / 1000;
+    perf_frag_process(remove, sizeof(remove), timer);
+
+    return ok;
+}
+#endif
+
+// Hot paths of the application, see perf_helper.h. Runs on the radio queue
+static void run_benchmarks()
+{
+    static const char  serial_hex[] = "0104000F";
+    static const uint8_t reject_command[] = { SET_DEVICE_CLASS, 0xff };
+    SpscMailbox<command_msg_t, 4> mailbox;
+    command_msg_t msg;
+    uint8_t payload[APP_PAYLOAD_MAX_SIZE];
+
+    // Keep console input out of the Rx buffer while it is used here
+    serial_rx_irq_enable = false;
+    serial_rx_buffer.reset();
+    memset(&msg, 0, sizeof(msg));
+
+#if FUOTA_STORAGE_PRESENT
+    // Runs before the results start, the session prints its own status lines
+    bool frag_ok = perf_frag_decode();
+#endif
+
+    perf_begin("radio", LORA_RADIO_NAME);
+
+    perf_run("atoh", 1000, [] {
+        uint8_t hex;
+        atoh(hex, 'a', '5');
+        perf_sink += hex;
+    });
+    perf_run("serial_decode/8", 200, [] {
+        for(const char *c = serial_hex; *c; c++)
+            serial_rx_buffer.push(*c);
+        perf_sink += decode_serial_command(sizeof(serial_hex) - 1);
+    });
+    // Dispatch and argument check of a rejected command, no side effects
+    perf_run("receive_command/reject", 1000, [] {
+        receive_command(reject_command, sizeof(reject_command), false);
+    });
+    perf_run("pack_uplink_payload", 1000, [&payload] {
+        perf_sink += pack_uplink_payload(payload, sizeof(payload));
+    });
+    perf_run("mailbox_put_get", 1000, [&mailbox, &msg] {
+        mailbox.put(msg);
+        perf_sink += mailbox.get(msg);
+    });
+    perf_run("beacon_history_estimate", 20, [] {
+        beacon_history_estimate();
+    });
+    perf_run("uplink_slot_phase", 1000, [] {
+        perf_sink += uplink_slot_phase_ms(app_tx_interval * 1000);
+    });
+    // Reads of the persisted settings as done by restore_config(), from a TDBStore in RAM
+    // so flash timing and the settings in use stay out of it
+    static const char *const keys[] = {
+        NVSTORE_TX_INTERVAL_KEY, NVSTORE_UPLINK_MSGTYPE_KEY, NVSTORE_ADR_ON_KEY, NVSTORE_DEVICE_CLASS_KEY,
+        NVSTORE_PING_SLOT_PERIODICITY, NVSTORE_TRACE_LEVEL_KEY, NVSTORE_TRACE_GROUPS_KEY
+    };
+    HeapBlockDevice perf_bd(PERF_KVSTORE_SIZE, 1, 1, PERF_KVSTORE_ERASE_SIZE);
+    TDBStore perf_store(&perf_bd);
+
+    if(perf_store.init() == MBED_SUCCESS)
+    {
+        for(uint8_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+        {
+            uint32_t value = i;
+            perf_store.set(strrchr(keys[i], '/') + 1, &value, sizeof(value), 0);
+        }
+
+        perf_run("restore_config/read", 20, [&perf_store] {
+            uint32_t value;
+            for(uint8_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+                perf_sink += persist_restore(keys[i], value, &perf_store);
+        });
+        perf_store.deinit();
+    }
+
+#if FUOTA_STORAGE_PRESENT
+    if(frag_ok)
+    {
+        perf_report_ms("fuota/session_100k", perf_frag_session_ms);
+        perf_report_ms("fuota/decode_100k", perf_frag_decode_ms);
+    }
+#endif
+
+    // Bring-up milestones of this boot, with the simulated radio this is a full Class B bring-up
+    const char *marks[] = { "boot/join_request", "boot/joined", "boot/first_uplink", "boot/class_b" };
+    for(uint8_t mark = 0; mark < BOOT_MARKS; mark++)
+    {
+        if(boot_mark_get(mark))
+            perf_report_ms(marks[mark], boot_mark_get(mark));
+    }
+
+    perf_end();
+
+    serial_rx_irq_enable = true;
+}
+#endif
+
 int main()
 {
+    boot_init(&console_queue);
+
+#if !MBED_CONF_RTOS_PRESENT
+    console_queue.chain(&ev_queue);
+#endif
+
     pc.baud(115200);
+#if MBED_CONF_RTOS_PRESENT
+    log_console.start(&console_queue);
+#endif
 
     // Serial Rx interrupt handler
-    pc.attach(mbed::callback(serial_rx_irq), Serial::RxIrq);
+    console_attach();
 
+    // Counters continue over a warm reset
     memset(&app_data, 0, sizeof(app_data));
+    boot_restore_state(&app_data, sizeof(app_data));
+    event_trace_init();
+    beacon_history_init();
 
-    // Add delay for debugger connection 
-    wait(3);
+    // Add delay for debugger connection, a warm reset goes straight to the radio
+    if(!boot_is_warm())
+        wait(3);
 
     // Initialize device class
     if(strcmp(DEVICE_CLASS, "A") == 0)
@@ -409,6 +1445,11 @@ int main()
 
     // Restore persisted configuration 
     restore_config();
+    event_trace_record(TRACE_TYPE_BOOT, MAJOR_VERSION, MINOR_VERSION, app_trace_flags());
+
+    // From here a wedged main or radio queue resets the device
+    watchdog_init(&ev_queue, &console_queue, app_trace_flags, app_queue_depth);
+    watchdog_attach_reset(prepare_reset);
 
     for(uint8_t i=0; i< 8; i++)
     {
@@ -422,26 +1463,39 @@ int main()
     if(use_builtin_deveui)
         get_built_in_dev_eui(DEV_EUI, sizeof(DEV_EUI));
 
+    uplink_slot_init(DEV_EUI, sizeof(DEV_EUI));
+
     if (DEV_EUI[0] == 0x0 && DEV_EUI[1] == 0x0 &&
         DEV_EUI[2] == 0x0 && DEV_EUI[3] == 0x0 &&
         DEV_EUI[4] == 0x0 && DEV_EUI[5] == 0x0 &&
         DEV_EUI[6] == 0x0 && DEV_EUI[7] == 0x0) {
         while(true) {
-            ThisThread::sleep_for(3000);
+            app_sleep_ms(3000);
             printf("Set your LoRaWAN credentials first!\n");
         }
         return -1;
     }
 
-    display_app_info();
-    display_command_help();
+    if(!boot_is_warm())
+    {
+        display_app_info();
+        display_command_help();
+    }
+
+    // Enable trace output for this demo, so we can see what the LoRaWAN stack does.
+    // Level and groups come from the persisted configuration
+    trace_filter_init();
+
+    adr_assist_init(xstr(MBED_CONF_LORA_PHY));
 
-    // Enable trace output for this demo, so we can see what the LoRaWAN stack does
-    mbed_trace_init();
+#if FUOTA_STORAGE_PRESENT
+    if(frag_session_init(&bd) != 0)
+        printf("FUOTA block device initialization failed!\n");
+#endif
 
     if (lorawan.initialize(&ev_queue) != LORAWAN_STATUS_OK) {
         while(true) {
-            ThisThread::sleep_for(3000);
+            app_sleep_ms(3000);
             printf("LoRa initialization failed!\n");
         }
     }
@@ -451,6 +1505,17 @@ int main()
     callbacks.link_check_resp = mbed::callback(link_check_response);
     lorawan.add_app_callbacks(&callbacks);
 
+#if SIM_NETWORK_SERVER
+    ns_emu_init(&radio, &ev_queue, APP_KEY, MBED_CONF_APP_LORA_CONFIG_PORT, app_device_class,
+                MBED_CONF_APP_SIM_NS_SCRIPT, MBED_CONF_APP_SIM_GPS_START);
+#endif
+
+    // Downlink routing, configuration and firmware fragments are also accepted from multicast groups
+    port_router_register(MBED_CONF_APP_LORA_CONFIG_PORT, PORT_ROUTE_ANY, mbed::callback(config_port_handler));
+#if FUOTA_STORAGE_PRESENT
+    port_router_register(FRAG_PORT, PORT_ROUTE_ANY, mbed::callback(frag_port_handler));
+#endif
+
     lorawan_connect_t connect_params;
     connect_params.connect_type = LORAWAN_CONNECTION_OTAA;
     connect_params.connection_u.otaa.dev_eui = DEV_EUI;
@@ -458,13 +1523,14 @@ int main()
     connect_params.connection_u.otaa.app_key = APP_KEY;
     connect_params.connection_u.otaa.nwk_key = APP_KEY;
     connect_params.connection_u.otaa.nb_trials = MBED_CONF_LORA_NB_TRIALS;
+    boot_mark(BOOT_MARK_CONNECT);
     lorawan_status_t retcode = lorawan.connect(connect_params);
 
     if (retcode == LORAWAN_STATUS_OK ||
         retcode == LORAWAN_STATUS_CONNECT_IN_PROGRESS) {
     } else {
         while(true) {
-            ThisThread::sleep_for(3000);
+            app_sleep_ms(3000);
             printf("Connection error, code = %d\n", retcode);
         }
         return -1;
@@ -474,20 +1540,36 @@ int main()
 
 
     if(app_device_class == CLASS_B){
-        ev_queue.call_every(PRINT_NETWORK_TIME_INTERVAL, &print_network_time);
+        console_queue.call_every(PRINT_NETWORK_TIME_INTERVAL, &print_network_time);
     }
 
+    queue_probe_start(&radio_probe, "radio", &ev_queue, MBED_CONF_APP_QUEUE_PROBE_INTERVAL);
+    queue_probe_start(&console_probe, "console", &console_queue, MBED_CONF_APP_QUEUE_PROBE_INTERVAL);
+
+    power_audit_register("console", console_holds_deep_sleep);
+    power_audit_register("radio", radio_holds_deep_sleep);
+    if(MBED_CONF_APP_POWER_AUDIT_INTERVAL > 0)
+        console_queue.call_every(MBED_CONF_APP_POWER_AUDIT_INTERVAL, power_audit_sample);
+
     // make your event queue dispatching events forever
+#if MBED_CONF_RTOS_PRESENT
+    radio_thread.start(mbed::callback(&ev_queue, &EventQueue::dispatch_forever));
+    console_queue.dispatch_forever();
+#else
     ev_queue.dispatch_forever();
+#endif
 
     return 0;
 }
 
-static void receive_command(uint8_t* buffer, int size)
+static void receive_command(const uint8_t* buffer, int size, bool downlink)
 {
+    WatchdogScope watchdog_scope(WATCHDOG_HANDLER_COMMAND, MBED_CONF_APP_WATCHDOG_HANDLER_DEADLINE);
     int rc;
     lorawan_status_t status;
 
+    command_status = LORAWAN_STATUS_OK;
+
     switch(buffer[0])
     {
         case SET_TX_INTERVAL:
@@ -496,9 +1578,8 @@ static void receive_command(uint8_t* buffer, int size)
             if(size == 3)
             {
                 app_tx_interval = (buffer[1]<<8 | buffer[2]);
-                rc = kv_set(NVSTORE_TX_INTERVAL_KEY, &app_tx_interval, sizeof(app_tx_interval), 0);
-                printf("Set Transmit interval=%lu. ",app_tx_interval);
-                print_return_code(rc, MBED_SUCCESS);
+                printf("Set Transmit interval=%lu\n",app_tx_interval);
+                persist_setting(NVSTORE_TX_INTERVAL_KEY, &app_tx_interval, sizeof(app_tx_interval));
 
                 // Restart send with new interval
                 if(send_queued) 
@@ -515,17 +1596,18 @@ static void receive_command(uint8_t* buffer, int size)
             if((size == 2) && (buffer[1] <= 1))
             {
                 adr_on = buffer[1];
-                printf("Set ADR=%u. ",adr_on);
-
-                rc = kv_set(NVSTORE_ADR_ON_KEY, &adr_on, sizeof(adr_on), 0);
-                print_return_code(rc, MBED_SUCCESS);
+                printf("Set ADR=%u\n",adr_on);
+                persist_setting(NVSTORE_ADR_ON_KEY, &adr_on, sizeof(adr_on));
                 if(adr_on)
                     status = lorawan.enable_adaptive_datarate();
                 else
                     status = lorawan.disable_adaptive_datarate();
 
                 if(status != LORAWAN_STATUS_OK)
+                {
                     printf("Configuration Error - EventCode = %d\n", status);
+                    command_status = status;
+                }
             }
             break;
         }
@@ -534,10 +1616,8 @@ static void receive_command(uint8_t* buffer, int size)
             if((size == 2) && (buffer[1] <= 1))
             {
                 tx_flags = (buffer[1] == 0) ? MSG_UNCONFIRMED_FLAG : MSG_CONFIRMED_FLAG;
-                printf("Message type=%s. ",tx_flags == MSG_UNCONFIRMED_FLAG ?"unconfirmed":"confirmed");
-
-                rc = kv_set(NVSTORE_UPLINK_MSGTYPE_KEY, buffer +1 , 1, 0);
-                print_return_code(rc, MBED_SUCCESS);
+                printf("Message type=%s\n",tx_flags == MSG_UNCONFIRMED_FLAG ?"unconfirmed":"confirmed");
+                persist_setting(NVSTORE_UPLINK_MSGTYPE_KEY, buffer + 1, 1);
             }
             break;
         }
@@ -587,23 +1667,24 @@ static void receive_command(uint8_t* buffer, int size)
             if((size == 2) && (buffer[1] <= 2))
             {
                 uint8_t rx_device_class = buffer[1];
-                rc = kv_set(NVSTORE_DEVICE_CLASS_KEY, &rx_device_class, 1, 0);
+                persist_setting(NVSTORE_DEVICE_CLASS_KEY, &rx_device_class, 1);
                 printf("Configure device class=%s. ",get_device_class_string(static_cast<device_class_t>(rx_device_class)));
                 rc = set_device_class(static_cast<device_class_t>(rx_device_class));
                 print_return_code(rc, LORAWAN_STATUS_OK);
+                command_status = rc;
             }
             break;
         }
         case SW_RESET_CMD:
         {
             printf("Software Reset\n");
+            prepare_reset();
             NVIC_SystemReset();
             break;
         }
         case RESET_NONVOL_CMD:
         {
-            printf("Reset NVStore\n");
-            kv_reset("/kv");
+            persist_setting(NULL, NULL, 0);
 
             break;
 
@@ -618,15 +1699,58 @@ static void receive_command(uint8_t* buffer, int size)
                 status = lorawan.add_ping_slot_info_request(ping_slot_periodicity);
                 if (status != LORAWAN_STATUS_OK) {
                     printf("Add ping slot info request Error - EventCode = %d", status);
+                    command_status = status;
                 }
                 else{
-                    rc = kv_set(NVSTORE_PING_SLOT_PERIODICITY, &ping_slot_periodicity, 1, 0); 
-                    printf("Set ping slot periodicity=%u. ",ping_slot_periodicity);
-                    print_return_code(rc, MBED_SUCCESS);
+                    printf("Set ping slot periodicity=%u\n",ping_slot_periodicity);
+                    persist_setting(NVSTORE_PING_SLOT_PERIODICITY, &ping_slot_periodicity, 1);
                 }
             }
             break;
         }
+        case SET_TRACE_LEVEL:
+        {
+            if((size == 2) && trace_filter_set_level(buffer[1]))
+            {
+                printf("Set trace level=%s%s\n", trace_filter_level_names[buffer[1]],
+                    trace_filter_level_compiled(buffer[1]) ? "" : " (above mbed-trace.max-level)");
+                persist_setting(NVSTORE_TRACE_LEVEL_KEY, buffer + 1, 1);
+            }
+            break;
+        }
+        case SET_TRACE_GROUPS:
+        {
+            if(size == 3)
+            {
+                uint16_t groups = (buffer[1] << 8) | buffer[2];
+
+                trace_filter_set_groups(groups);
+                printf("Set trace groups=%04x\n", groups);
+                persist_setting(NVSTORE_TRACE_GROUPS_KEY, &groups, sizeof(groups));
+            }
+            break;
+        }
+        case GET_CONFIG_SNAPSHOT:
+        {
+            print_config_snapshot();
+            // Over the air the snapshot goes out with the next uplink, sent now
+            if(downlink)
+            {
+                config_export_requested = true;
+                if(send_queued)
+                {
+                    ev_queue.cancel(send_queued);
+                    send_queued = 0;
+                }
+                send_queued = ev_queue.call(&send_message);
+            }
+            break;
+        }
+        case SET_CONFIG_SNAPSHOT:
+        {
+            import_config_snapshot(buffer + 1, size - 1, downlink);
+            break;
+        }
         default:
         {
             printf("receive_cmd() - Unknown command=%u\n",buffer[0]);
@@ -635,10 +1759,78 @@ static void receive_command(uint8_t* buffer, int size)
     }
 }
 
+#if FUOTA_STORAGE_PRESENT
+static void send_frag_answer()
+{
+    frag_answer_t answer;
+
+    if(!frag_answer_mailbox.get(answer))
+        return;
+
+    int16_t retcode = lorawan.send(FRAG_PORT, answer.data, answer.size, MSG_UNCONFIRMED_FLAG);
+    if (retcode < 0)
+        printf("send() fragmentation answer - Error code %d\n", retcode);
+    else
+        adr_assist_sent(retcode);
+}
+
+static void run_frag_commands()
+{
+    frag_msg_t    msg;
+    frag_answer_t answer;
+
+    while(frag_mailbox.get(msg))
+    {
+        answer.size = frag_session_process(msg.data, msg.size, msg.multicast, answer.data, sizeof(answer.data));
+
+        // Answers are delayed so the stack is done with the current receive windows
+        if(answer.size == 0)
+            continue;
+        if(frag_answer_mailbox.put(answer))
+            ev_queue.call_in(MBED_CONF_APP_FUOTA_ANSWER_DELAY, send_frag_answer);
+        else
+            printf("FUOTA - answer dropped, previous answers not sent yet\n");
+    }
+}
+
+static void frag_port_handler(const uint8_t *buffer, uint8_t size, uint8_t port, int flags)
+{
+    frag_msg_t msg;
+
+    if((size < 1) || (size > sizeof(msg.data)))
+        return;
+
+    memcpy(msg.data, buffer, size);
+    msg.size      = size;
+    msg.multicast = (flags & MSG_MULTICAST_FLAG) != 0;
+
+    // A dropped fragment is recovered by the coded fragments
+    if(frag_mailbox.put(msg))
+        console_queue.call(run_frag_commands);
+    else
+        printf("FUOTA - downlink dropped, console queue busy\n");
+}
+#endif
+
+static void config_port_handler(const uint8_t *buffer, uint8_t size, uint8_t port, int flags)
+{
+    if(size >= 1)
+    {
+        event_trace_record(TRACE_TYPE_DOWNLINK_COMMAND, buffer[0], (size >= 2) ? buffer[1] : 0, app_trace_flags());
+        receive_command(buffer, size, true);
+#if SIM_NETWORK_SERVER
+        ns_emu_command_received(buffer, size, app_device_class);
+#endif
+    }
+}
+
+// Downlinks are received once into this buffer and handed to the port handlers as is
+static uint8_t rx_buffer[255];
+
 // This is called from RX_DONE, so whenever a message came in
 static void receive_message()
 {
-    uint8_t rx_buffer[255] = { 0 };
+    WatchdogScope watchdog_scope(WATCHDOG_HANDLER_RECEIVE, MBED_CONF_APP_WATCHDOG_HANDLER_DEADLINE);
     uint8_t port;
     int flags;
 
@@ -649,18 +1841,19 @@ static void receive_message()
     }
     app_data.rx++;
 
-    printf("Received %d bytes on port %u\n", retcode, port);
+    printf("Received %d bytes on port %u%s\n", retcode, port, (flags & MSG_MULTICAST_FLAG) ? " (multicast)" : "");
 
+#if MBED_CONF_APP_RX_HEX_DUMP
     printf("Data received on port %d (length %d): ", port, retcode);
 
     for (uint8_t i = 0; i < retcode; i++) {
         printf("%02x ", rx_buffer[i]);
     }
     printf("\n");
+#endif
 
-    if((port == MBED_CONF_APP_LORA_CONFIG_PORT) && (retcode >= 1))
-        receive_command(rx_buffer, retcode);
-
+    if(!port_router_dispatch(rx_buffer, retcode, port, flags))
+        printf("receive() - No handler for port %u\n", port);
 }
 
 lorawan_status_t enable_beacon_acquisition()
@@ -715,9 +1908,14 @@ void switch_to_class_b(void)
         status = lorawan.set_device_class(CLASS_B);
         if (status == LORAWAN_STATUS_OK) {
             class_b_on = true;
+            boot_mark(BOOT_MARK_CLASS_B);
+#if SIM_NETWORK_SERVER
+            ns_emu_set_device_class(CLASS_B);
+#endif
             // Send uplink now to notify server device is class B
             uint8_t dummy_value;
-            lorawan.send(MBED_CONF_APP_LORA_UPLINK_PORT, &dummy_value, 1, MSG_UNCONFIRMED_FLAG);
+            if(lorawan.send(MBED_CONF_APP_LORA_UPLINK_PORT, &dummy_value, 1, MSG_UNCONFIRMED_FLAG) > 0)
+                adr_assist_sent(1);
 
         } else {
             printf("Switch Device Class -> B Error - EventCode = %d\n", status);
@@ -748,6 +1946,10 @@ lorawan_status_t set_device_class(device_class_t device_class)
         case CLASS_A:
         case CLASS_C:
             status = lorawan.set_device_class(device_class);
+#if SIM_NETWORK_SERVER
+            if(status == LORAWAN_STATUS_OK)
+                ns_emu_set_device_class(device_class);
+#endif
             device_time_synched = false;
             class_b_on = false;
             if(beacon_acq_enabled) {
@@ -787,14 +1989,38 @@ lorawan_status_t set_device_class(device_class_t device_class)
     return status;
 }
 
+// Data rate and time on air of the uplink just sent
+static void record_tx_metadata()
+{
+    lorawan_tx_metadata metadata;
+
+    if(lorawan.get_tx_metadata(metadata) == LORAWAN_STATUS_OK)
+        adr_assist_tx_done(metadata.data_rate, metadata.tx_toa);
+}
+
 // Event handler
 static void lora_event_handler(lorawan_event_t event)
 {
+    WatchdogScope watchdog_scope(WATCHDOG_HANDLER_EVENT, MBED_CONF_APP_WATCHDOG_HANDLER_DEADLINE);
+    uint64_t beacon_us;
+
+    event_trace_record(TRACE_TYPE_EVENT, event_trace_code(event), 0, app_trace_flags());
+
     switch (event) {
         case CONNECTED:
             printf("Connection - Successful\n");
+            boot_mark(BOOT_MARK_JOINED);
             set_device_class(app_device_class);
+#if MBED_CONF_APP_UPLINK_SLOTTING
+            // First uplink at this device's phase in the interval, so a fleet joining together does not uplink together
+            if(!send_queued) {
+                uint32_t phase = uplink_slot_phase_ms(app_tx_interval * 1000);
+                printf("First uplink in %lu ms\n", phase);
+                send_queued = ev_queue.call_in(phase, &send_message);
+            }
+#else
             send_message();
+#endif
             break;
         case DISCONNECTED:
             ev_queue.break_dispatch();
@@ -802,6 +2028,11 @@ static void lora_event_handler(lorawan_event_t event)
             break;
         case TX_DONE:
             printf("Message sent to Network Server\n");
+            boot_mark(BOOT_MARK_UPLINK);
+            record_tx_metadata();
+            power_cycle_mark();
+            energy_cycle_mark();
+            trace_filter_cycle_mark();
             queue_next_send_message();
             break;
         case TX_TIMEOUT:
@@ -809,6 +2040,10 @@ static void lora_event_handler(lorawan_event_t event)
         case TX_CRYPTO_ERROR:
         case TX_SCHEDULING_ERROR:
             printf("Transmission Error - EventCode = %d\n", event);
+            adr_assist_tx_failed();
+            power_cycle_mark();
+            energy_cycle_mark();
+            trace_filter_cycle_mark();
             queue_next_send_message();
             break;
         case RX_DONE:
@@ -845,27 +2080,34 @@ static void lora_event_handler(lorawan_event_t event)
                 enable_beacon_acquisition();
             break;
         case BEACON_FOUND:
+            // Arrival time first, the LED and the console output would add to the jitter
+            beacon_us = beacon_history_now();
             debug_rx_led(1);
             beacon_found = true;
             app_data.beacon_lock++;
             printf("Beacon Acquisiton Success\n");
-            print_received_beacon();
+            print_received_beacon(beacon_us);
             switch_to_class_b();
             break;
         case BEACON_LOCK:
+            beacon_us = beacon_history_now();
             debug_rx_led(1);
             app_data.beacon_lock++;
-            print_received_beacon();
+            print_received_beacon(beacon_us);
             printf("Beacon Lock Count=%u\r\n", app_data.beacon_lock);
             break;
         case BEACON_MISS:
             debug_rx_led(2);
             app_data.beacon_miss++;
+            beacon_history_miss();
             printf("Beacon Miss Count=%u\r\n", app_data.beacon_miss);
             break;
         case SWITCH_CLASS_B_TO_A:
             printf("Reverted Class B -> A\n");
             class_b_on = false;
+#if SIM_NETWORK_SERVER
+            ns_emu_set_device_class(CLASS_A);
+#endif
             if(app_device_class == CLASS_B)
                 enable_beacon_acquisition();
             break;
@@ -876,11 +2118,13 @@ static void lora_event_handler(lorawan_event_t event)
 
 static void link_check_response(uint8_t demod_margin, uint8_t gw_cnt)
 {
+    event_trace_record(TRACE_TYPE_CALLBACK, TRACE_CB_LINK_CHECK, gw_cnt, app_trace_flags());
     printf("LinkCheckAns Margin=%u, GwCnt=%u\n",demod_margin, gw_cnt);
     lorawan.remove_link_check_request();
 }
 
-void print_received_beacon()
+// local_us is the local clock when the beacon event was handled
+void print_received_beacon(uint64_t local_us)
 {
     loramac_beacon_t beacon;
     lorawan_status_t status;
@@ -888,8 +2132,11 @@ void print_received_beacon()
     status = lorawan.get_last_rx_beacon(beacon);
     if (status != LORAWAN_STATUS_OK) {
         printf("Get Received Beacon Error - EventCode = %d\n", status);
+        return;
     }
 
+    beacon_history_add(beacon.time, beacon.gw_specific, local_us);
+
     printf("\nReceived Beacon Time=%lu, GwSpecific=", beacon.time);
     for (uint8_t i = 0; i < sizeof(beacon.gw_specific); i++) {
         printf("%02X", beacon.gw_specific[i]);
@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+"""
+Write a build variant of mbed_app.json with extra overrides applied to all
+targets ("*"), for mbed compile --app-config. Used by the Makefile for the
+tiny and low-power builds.
+
+Each override is name=value, the value is JSON when it parses as JSON and a
+string otherwise.
+
+Usage: app_config.py [--base mbed_app.json] out.json name=value...
+"""
+
+import argparse
+import json
+
+
+def parse_value(text):
+    try:
+        return json.loads(text)
+    except ValueError:
+        return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split('\n')[0])
+    parser.add_argument('--base', default='mbed_app.json')
+    parser.add_argument('out')
+    parser.add_argument('overrides', nargs='+', metavar='name=value')
+    args = parser.parse_args()
+
+    with open(args.base) as base:
+        config = json.load(base)
+
+    overrides = config.setdefault('target_overrides', {}).setdefault('*', {})
+    for override in args.overrides:
+        name, sep, value = override.partition('=')
+        if not sep:
+            parser.error('override %s is not name=value' % override)
+        overrides[name] = parse_value(value)
+
+    with open(args.out, 'w') as out:
+        json.dump(config, out, indent=4)
+        out.write('\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,174 @@
+#!/usr/bin/env python
+"""
+Fleet uplink collision simulation after a mass power restore.
+
+Every device joins shortly after power comes back and then uplinks every
+interval. Uplinks pick a random channel and collide when they overlap in time
+on the same channel (pure ALOHA, no capture effect). Device clocks drift by up
+to +/- drift ppm.
+
+Scheduling modes, see source/helpers/uplink_slot_helper.h:
+  lockstep  first uplink at CONNECTED, then every interval (slotting off)
+  slotted   first uplink after the DevEUI hashed phase, then interval + jitter
+  gps       Class B, uplinks on the GPS time grid at the hashed phase + jitter
+
+Usage: fleet_collision_sim.py [--devices N] [--interval s] [--hours h] [--jitter pct,pct,...]
+"""
+
+import argparse
+import bisect
+import random
+
+MASK32 = 0xffffffff
+
+
+def fnv1a(data):
+    h = 2166136261
+    for b in data:
+        h ^= b
+        h = (h * 16777619) & MASK32
+    return h
+
+
+class Device(object):
+    def __init__(self, dev_eui, drift_ppm):
+        self.hash = fnv1a(dev_eui)
+        self.state = self.hash or 1
+        self.drift = 1.0 + drift_ppm * 1e-6
+
+    def phase_ms(self, interval_ms):
+        return self.hash % interval_ms
+
+    def jitter_ms(self, interval_ms, pct):
+        span = interval_ms * pct // 100
+        s = self.state
+        s ^= (s << 13) & MASK32
+        s ^= s >> 17
+        s ^= (s << 5) & MASK32
+        self.state = s
+        if span == 0:
+            return 0
+        return s % (2 * span + 1) - span
+
+    def gps_delay_ms(self, gps_ms, interval_ms):
+        half = interval_ms // 2
+        position = (int(gps_ms) + half) % interval_ms
+        return half + (self.phase_ms(interval_ms) + interval_ms - position) % interval_ms
+
+
+def time_on_air_ms(payload, sf, bw=125000, cr=1, preamble=8, header=True, crc=True):
+    tsym = (2.0 ** sf) / bw * 1000
+    de = 1 if (sf >= 11 and bw == 125000) else 0
+    n = 8 * payload - 4 * sf + 28 + (16 if crc else 0) - (0 if header else 20)
+    nb = 8 + max(int(-(-n // (4 * (sf - 2 * de)))) * (cr + 4), 0)
+    return (preamble + 4.25) * tsym + nb * tsym
+
+
+def schedule(devices, mode, args, jitter_pct, rng):
+    interval_ms = args.interval * 1000
+    end_ms = args.hours * 3600 * 1000
+    packets = []
+    for index, dev in enumerate(devices):
+        t = rng.uniform(0, args.join_spread * 1000)
+        if mode == 'slotted':
+            t += dev.phase_ms(interval_ms)
+        elif mode == 'gps':
+            t += dev.gps_delay_ms(t, interval_ms) - interval_ms
+        while t < end_ms:
+            packets.append((t, rng.randrange(args.channels), index))
+            if mode == 'lockstep':
+                delay = interval_ms
+            elif mode == 'slotted':
+                delay = interval_ms + dev.jitter_ms(interval_ms, jitter_pct)
+            else:
+                # GPS time is tracked through the beacon, no local drift
+                delay = dev.gps_delay_ms(t, interval_ms) + dev.jitter_ms(interval_ms, jitter_pct)
+                t += max(delay, args.min_interval * 1000)
+                continue
+            t += delay * dev.drift
+    return packets
+
+
+def collisions(packets, toa_ms, channels):
+    lost = set()
+    for ch in range(channels):
+        starts = sorted((p[0], i) for i, p in enumerate(packets) if p[1] == ch)
+        times = [s[0] for s in starts]
+        for k, (start, i) in enumerate(starts):
+            if k > 0 and times[k - 1] + toa_ms > start:
+                lost.add(i)
+                lost.add(starts[k - 1][1])
+            j = bisect.bisect_left(times, start + toa_ms)
+            for m in range(k + 1, j):
+                lost.add(i)
+                lost.add(starts[m][1])
+    return lost
+
+
+def run(mode, jitter_pct, args):
+    rng = random.Random(args.seed)
+    devices = []
+    for n in range(args.devices):
+        # Fleets are provisioned with sequential DevEUIs
+        eui = (0x0012345600000000 + n).to_bytes(8, 'big')
+        devices.append(Device(eui, rng.uniform(-args.drift, args.drift)))
+
+    toa = time_on_air_ms(args.payload + 13, args.sf)
+    packets = schedule(devices, mode, args, jitter_pct, rng)
+    lost = collisions(packets, toa, args.channels)
+
+    storm_end = args.join_spread * 1000 + 2 * args.interval * 1000
+    storm = [i for i, p in enumerate(packets) if p[0] < storm_end]
+    storm_ok = sum(1 for i in storm if i not in lost)
+
+    per_device = {}
+    streak = {}
+    max_streak = 0
+    for i, p in sorted(enumerate(packets), key=lambda x: x[1][0]):
+        ok, total = per_device.get(p[2], (0, 0))
+        per_device[p[2]] = (ok + (i not in lost), total + 1)
+        s = streak.get(p[2], 0) + 1 if i in lost else 0
+        streak[p[2]] = s
+        max_streak = max(max_streak, s)
+
+    pdr_devices = sorted(float(ok) / total for ok, total in per_device.values())
+    return {
+        'pdr': 1.0 - float(len(lost)) / len(packets),
+        'storm_pdr': float(storm_ok) / len(storm) if storm else 1.0,
+        'p5_device_pdr': pdr_devices[len(pdr_devices) // 20],
+        'max_loss_streak': max_streak,
+        'toa_ms': toa,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--devices', type=int, default=2000)
+    parser.add_argument('--interval', type=int, default=600, help='uplink interval in seconds')
+    parser.add_argument('--min-interval', type=int, default=5, help='MIN_TX_INTERVAL in seconds')
+    parser.add_argument('--hours', type=float, default=6)
+    parser.add_argument('--channels', type=int, default=8, help='US915 sub-band')
+    parser.add_argument('--sf', type=int, default=10, help='US915 DR0')
+    parser.add_argument('--payload', type=int, default=6, help='application payload bytes')
+    parser.add_argument('--join-spread', type=float, default=10, help='joins complete within this many seconds')
+    parser.add_argument('--drift', type=float, default=20, help='crystal tolerance in ppm')
+    parser.add_argument('--jitter', default='0,2,5,10,20', help='jitter percentages to evaluate')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    print('%d devices, %d s interval, SF%d, %d channels, %.1f h, joins within %.0f s' %
+          (args.devices, args.interval, args.sf, args.channels, args.hours, args.join_spread))
+    print('%-9s %7s %8s %10s %10s %12s' % ('mode', 'jitter', 'PDR', 'storm PDR', 'p5 device', 'loss streak'))
+
+    cases = [('lockstep', 0)]
+    for mode in ('slotted', 'gps'):
+        cases += [(mode, int(j)) for j in args.jitter.split(',')]
+
+    for mode, jitter in cases:
+        r = run(mode, jitter, args)
+        print('%-9s %6u%% %8.3f %10.3f %10.3f %12u' %
+              (mode, jitter, r['pdr'], r['storm_pdr'], r['p5_device_pdr'], r['max_loss_streak']))
+
+
+if __name__ == '__main__':
+    main()
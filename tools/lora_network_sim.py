@@ -0,0 +1,207 @@
+#!/usr/bin/env python
+"""
+LoRaWAN network simulation with the channel model of the simulated radio.
+
+Same model as source/helpers/sim_channel_helper.h: log-distance path loss
+with log-normal shadowing, SF dependent SNR thresholds, capture effect between
+packets on the same SF, SF isolation, gateways on a square grid and a packet
+being received when any gateway gets it. The model constants are read from
+that header, the model itself is a separate Python implementation and has to
+be kept in step with it by hand.
+
+The two differ in what collides. On the device the simulated radio sees the
+rest of the network only as a Poisson background per channel, with random
+positions and SFs. Here every device is simulated, packets collide with the
+actual uplinks of the other devices, including the slotting of
+uplink_slot_helper.h. Collision rates from the two are not the same quantity.
+
+Devices are placed uniformly over a disc around the gateways and use the
+lowest SF that closes their link to the nearest gateway with a margin (as ADR
+would settle). Each device uplinks every interval with the jitter of
+source/helpers/uplink_slot_helper.h on a random channel. Channels are
+independent, they are simulated in parallel, one process per channel.
+
+Usage: lora_network_sim.py [--devices N] [--gateways N] [--hours h] [--workers N]
+"""
+
+import argparse
+import bisect
+import math
+import multiprocessing
+import os
+import random
+import re
+import time
+
+from fleet_collision_sim import time_on_air_ms
+
+CHANNEL_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              '..', 'source', 'helpers', 'sim_channel_helper.h')
+
+
+def read_channel_model(path):
+    """Return the SIM_* defines and the SNR thresholds by SF of the channel model."""
+    with open(path) as header:
+        text = header.read()
+    defines = dict((name, float(value)) for name, value in
+                   re.findall(r'#define\s+SIM_(\w+)\s+(-?[0-9.]+)f?\b', text))
+    thresholds = re.search(r'sim_snr_threshold\[\]\s*=\s*\{([^}]*)\}', text).group(1)
+    snr = dict((7 + i, float(v.strip().rstrip('f'))) for i, v in enumerate(thresholds.split(',')))
+    return defines, snr
+
+
+MODEL, SNR_THRESHOLD = read_channel_model(CHANNEL_HEADER)
+PATH_LOSS_1KM_DB = MODEL['PATH_LOSS_1KM_DB']
+PATH_LOSS_EXPONENT = MODEL['PATH_LOSS_EXPONENT']
+SHADOWING_DB = MODEL['SHADOWING_DB']
+NOISE_FIGURE_DB = MODEL['NOISE_FIGURE_DB']
+CAPTURE_DB = MODEL['CAPTURE_DB']
+SF_ISOLATION_DB = MODEL['SF_ISOLATION_DB']
+DEVICE_TX_POWER_DBM = MODEL['DEVICE_TX_POWER_DBM']
+
+
+def path_loss_db(distance_m):
+    return PATH_LOSS_1KM_DB + 10.0 * PATH_LOSS_EXPONENT * math.log10(max(distance_m, 1.0) / 1000.0)
+
+
+def noise_floor_dbm(bandwidth_hz=125000):
+    return -174.0 + 10.0 * math.log10(bandwidth_hz) + NOISE_FIGURE_DB
+
+
+def gateway_grid(count, spacing):
+    side = 1
+    while side * side < count:
+        side += 1
+    return [((i % side) * spacing, (i // side) * spacing) for i in range(count)]
+
+
+def place_devices(args, gateways, rng):
+    """Return per device (sf, [mean rssi per gateway])."""
+    cx = sum(g[0] for g in gateways) / len(gateways)
+    cy = sum(g[1] for g in gateways) / len(gateways)
+    noise = noise_floor_dbm()
+    devices = []
+    for _ in range(args.devices):
+        r = args.radius * math.sqrt(rng.random())
+        a = 2 * math.pi * rng.random()
+        x, y = cx + r * math.cos(a), cy + r * math.sin(a)
+        rssi = [DEVICE_TX_POWER_DBM - path_loss_db(math.hypot(x - gx, y - gy)) for gx, gy in gateways]
+        snr = max(rssi) - noise
+        sf = 7
+        while sf < 12 and snr < SNR_THRESHOLD[sf] + args.margin:
+            sf += 1
+        devices.append((sf, rssi))
+    return devices
+
+
+def schedule(args, devices, rng):
+    """Uplinks as (start_ms, device) per channel."""
+    interval = args.interval * 1000.0
+    span = interval * args.jitter / 100.0
+    end = args.hours * 3600 * 1000.0
+    per_channel = [[] for _ in range(args.channels)]
+    for index in range(len(devices)):
+        t = rng.uniform(0, interval)
+        while t < end:
+            per_channel[rng.randrange(args.channels)].append((t, index))
+            t += interval + rng.uniform(-span, span)
+    return per_channel
+
+
+def simulate_channel(job):
+    """Return {sf: [sent, received]} for the uplinks of one channel."""
+    packets, devices, toa, seed = job
+    rng = random.Random(seed)
+    noise = noise_floor_dbm()
+    packets.sort()
+    starts = [p[0] for p in packets]
+    gateways = len(devices[0][1])
+    max_toa = max(toa.values())
+
+    # Received power of every packet at every gateway, shadowing per packet
+    rssi = [[m + rng.gauss(0, SHADOWING_DB) for m in devices[dev][1]] for _, dev in packets]
+
+    result = {}
+    for i, (start, dev) in enumerate(packets):
+        sf = devices[dev][0]
+        end = start + toa[sf]
+        lo = bisect.bisect_left(starts, start - max_toa)
+        hi = bisect.bisect_left(starts, end)
+        overlapping = [j for j in range(lo, hi)
+                       if j != i and starts[j] + toa[devices[packets[j][1]][0]] > start]
+
+        received = False
+        for g in range(gateways):
+            ours = rssi[i][g]
+            if ours - noise < SNR_THRESHOLD[sf]:
+                continue
+            lost = False
+            for j in overlapping:
+                other = rssi[j][g]
+                if devices[packets[j][1]][0] == sf:
+                    lost = ours - other < CAPTURE_DB
+                else:
+                    lost = other - ours > SF_ISOLATION_DB
+                if lost:
+                    break
+            if not lost:
+                received = True
+                break
+
+        counts = result.setdefault(sf, [0, 0])
+        counts[0] += 1
+        counts[1] += received
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--devices', type=int, default=10000)
+    parser.add_argument('--gateways', type=int, default=4)
+    parser.add_argument('--spacing', type=float, default=3000, help='gateway grid spacing in m')
+    parser.add_argument('--radius', type=float, default=5000, help='device area radius in m')
+    parser.add_argument('--interval', type=int, default=600, help='uplink interval in seconds')
+    parser.add_argument('--jitter', type=float, default=5, help='uplink jitter in percent of the interval')
+    parser.add_argument('--hours', type=float, default=24)
+    parser.add_argument('--channels', type=int, default=8)
+    parser.add_argument('--payload', type=int, default=6, help='application payload bytes')
+    parser.add_argument('--margin', type=float, default=5, help='ADR link margin in dB')
+    parser.add_argument('--workers', type=int, default=multiprocessing.cpu_count())
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+
+    t0 = time.time()
+    rng = random.Random(args.seed)
+    gateways = gateway_grid(args.gateways, args.spacing)
+    devices = place_devices(args, gateways, rng)
+    toa = dict((sf, time_on_air_ms(args.payload + 13, sf)) for sf in SNR_THRESHOLD)
+    per_channel = schedule(args, devices, rng)
+
+    jobs = [(packets, devices, toa, args.seed * 1000 + ch) for ch, packets in enumerate(per_channel)]
+    pool = multiprocessing.Pool(min(args.workers, len(jobs)))
+    results = pool.map(simulate_channel, jobs)
+    pool.close()
+
+    totals = {}
+    for result in results:
+        for sf, (sent, received) in result.items():
+            t = totals.setdefault(sf, [0, 0])
+            t[0] += sent
+            t[1] += received
+
+    sent = sum(t[0] for t in totals.values())
+    received = sum(t[1] for t in totals.values())
+    elapsed = time.time() - t0
+
+    print('%d devices, %d gateways, %.1f h, %d channels, %d workers' %
+          (args.devices, args.gateways, args.hours, args.channels, args.workers))
+    print('%-5s %8s %10s %8s' % ('SF', 'devices', 'uplinks', 'PDR'))
+    for sf in sorted(totals):
+        count = sum(1 for d in devices if d[0] == sf)
+        print('SF%-3u %8u %10u %8.3f' % (sf, count, totals[sf][0], float(totals[sf][1]) / totals[sf][0]))
+    print('all   %8u %10u %8.3f' % (len(devices), sent, float(received) / sent if sent else 1.0))
+    print('%u uplinks simulated in %.1f s' % (sent, elapsed))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,110 @@
+#!/usr/bin/env python
+"""
+Extract the benchmark results of the application ('P' console command, build
+with perf-benchmarks enabled) from a serial log and compare them with a
+baseline.
+
+The results are printed by source/helpers/perf_helper.h as Google Benchmark
+JSON between PERF-BEGIN and PERF-END. The last block of the log is used, lines
+printed by other threads in between are dropped.
+
+A benchmark regresses when its time grew by more than the threshold, the exit
+code is 1 when any benchmark regressed so CI can flag the commit. Boot
+milestones depend on the radio link and are only compared with --milestones.
+
+Usage: perf_compare.py [--out results.json] [--baseline baseline.json]
+                       [--threshold percent] [--milestones] log.txt
+"""
+
+import argparse
+import json
+import re
+import sys
+
+# The lines perf_helper.h prints inside the block, anything else (traces,
+# console output of other threads) is skipped
+JSON_LINE = re.compile(r'^(\{"context": \{.*\},'
+                       r'| "benchmarks": \['
+                       r'|  \{"name": ".*"\},?'
+                       r'| \]\}'
+                       r'|)$')
+
+
+def extract(path):
+    results = None
+    block = None
+    with open(path) as log:
+        for line in log:
+            line = line.rstrip('\r\n')
+            if line.startswith('PERF-BEGIN'):
+                block = []
+            elif line.startswith('PERF-END'):
+                if block is not None:
+                    results = json.loads('\n'.join(block))
+                block = None
+            elif block is not None and JSON_LINE.match(line):
+                block.append(line)
+    if results is None:
+        sys.exit('%s: no PERF-BEGIN/PERF-END block' % path)
+    return results
+
+
+def compare(results, baseline, threshold, milestones):
+    base = dict((b['name'], b) for b in baseline['benchmarks'])
+    regressed = 0
+
+    print('%-28s %12s %12s %8s' % ('Benchmark', 'Baseline', 'Current', 'Change'))
+    for bench in results['benchmarks']:
+        old = base.get(bench['name'])
+        if old is None or old['time_unit'] != bench['time_unit']:
+            print('%-28s %12s %9u %-2s %8s' % (bench['name'], '-', bench['real_time'], bench['time_unit'], 'new'))
+            continue
+
+        change = 100.0 * (bench['real_time'] - old['real_time']) / old['real_time'] if old['real_time'] else 0.0
+        checked = milestones or bench.get('run_type') != 'milestone'
+        flag = ''
+        if checked and change > threshold:
+            flag = ' REGRESSION'
+            regressed += 1
+
+        print('%-28s %9u %-2s %9u %-2s %+7.1f%%%s' % (bench['name'], old['real_time'], old['time_unit'],
+                                                   bench['real_time'], bench['time_unit'], change, flag))
+
+    return regressed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('log')
+    parser.add_argument('--out', help='write the extracted results as JSON')
+    parser.add_argument('--baseline', help='results JSON to compare with')
+    parser.add_argument('--threshold', type=float, default=10.0, help='allowed slowdown in percent')
+    parser.add_argument('--milestones', action='store_true', help='also compare boot milestones')
+    args = parser.parse_args()
+
+    results = extract(args.log)
+
+    if args.out:
+        with open(args.out, 'w') as out:
+            json.dump(results, out, indent=2)
+
+    if not args.baseline:
+        for bench in results['benchmarks']:
+            print('%-28s %9u %s' % (bench['name'], bench['real_time'], bench['time_unit']))
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    if baseline['context'].get('mhz_per_cpu') != results['context'].get('mhz_per_cpu'):
+        print('Warning: CPU clock differs from the baseline')
+
+    regressed = compare(results, baseline, args.threshold, args.milestones)
+    if regressed:
+        print('%u benchmark(s) regressed by more than %.1f%%' % (regressed, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
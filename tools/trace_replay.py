@@ -0,0 +1,368 @@
+#!/usr/bin/env python
+"""
+Replay an event trace dumped by the application ('t' or 'T' console command).
+
+The trace is read from a serial log, the records between TRACE-BEGIN and
+TRACE-END are decoded and replayed as fast as possible against a model of the
+Class B state handling in source/main.cpp (lora_event_handler,
+set_device_class, enable_beacon_acquisition and switch_to_class_b). After each
+record the model state is compared with the state flags recorded with the next
+record, a mismatch means the device did something the model did not expect,
+for example a stack call that failed. The model is resynchronized to the
+recorded flags after a divergence.
+
+The model is a copy of the C++ logic, so before replaying the record tables
+and flags below are checked against event_trace_helper.h and main.cpp, and
+the state handling of the modelled functions against MODEL_DIGEST: a digest
+of their lines that touch the state flags, case labels and modelled calls.
+Any drift fails with exit code 2. After reviewing AppModel against a changed
+main.cpp, update MODEL_DIGEST with the value the check prints. --check only
+runs the check, for CI.
+
+Usage: trace_replay.py [--verbose] [--json] [--source dir] log.txt
+       trace_replay.py --check [--source dir]
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import re
+import sys
+import time
+
+# Must match source/helpers/event_trace_helper.h
+TRACE_VERSION = 1
+
+TYPE_EVENT, TYPE_CALLBACK, TYPE_SERIAL_COMMAND, TYPE_DOWNLINK_COMMAND, TYPE_BOOT = 1, 2, 3, 4, 5
+
+EVENTS = {
+    1: 'CONNECTED', 2: 'DISCONNECTED', 3: 'TX_DONE', 4: 'TX_ERROR', 5: 'RX_DONE',
+    6: 'RX_ERROR', 7: 'JOIN_FAILURE', 8: 'DEVICE_TIME_SYNCHED', 9: 'PING_SLOT_INFO_SYNCHED',
+    10: 'BEACON_NOT_FOUND', 11: 'BEACON_FOUND', 12: 'BEACON_LOCK', 13: 'BEACON_MISS',
+    14: 'SWITCH_CLASS_B_TO_A', 15: 'OTHER',
+}
+
+CALLBACKS = {1: 'LINK_CHECK'}
+
+# Command opcodes from source/main.cpp
+SET_DEVICE_CLASS = 4
+SET_PING_SLOT_PERIODICITY = 5
+
+CLASS_A, CLASS_B, CLASS_C = 0, 1, 2
+
+FLAG_CLASS_B_ON = 0x04
+FLAG_BEACON_ACQ = 0x08
+FLAG_PING_SLOT_SYNCHED = 0x10
+FLAG_TIME_SYNCHED = 0x20
+FLAG_BEACON_FOUND = 0x40
+
+# main.cpp state variable behind each flag, see app_trace_flags()
+FLAG_VARIABLES = {
+    'class_b_on': 'CLASS_B_ON', 'beacon_acq_enabled': 'BEACON_ACQ',
+    'ping_slot_synched': 'PING_SLOT_SYNCHED', 'device_time_synched': 'TIME_SYNCHED',
+    'beacon_found': 'BEACON_FOUND',
+}
+
+# main.cpp functions AppModel copies, and the digest of their state handling
+MODEL_FUNCTIONS = ('lora_event_handler', 'set_device_class', 'enable_beacon_acquisition',
+                   'switch_to_class_b', 'receive_command')
+MODEL_DIGEST = '89a0ed54253e'
+
+PRINT_LINE = re.compile(r'\w*(printf|tr_\w+)\(')
+MODEL_LINE = re.compile(r'\b(%s|app_device_class|case|%s)\b' %
+                        ('|'.join(FLAG_VARIABLES), '|'.join(MODEL_FUNCTIONS[1:4])))
+
+
+def read_defines(path, prefix):
+    defines = {}
+    with open(path) as f:
+        for m in re.finditer(r'^#define\s+%s(\w+)\s+(0x[0-9a-fA-F]+|\d+)\b' % prefix, f.read(), re.M):
+            defines[m.group(1)] = int(m.group(2), 0)
+    return defines
+
+
+def function_body(source, name):
+    """Lines of the definition of function name in source, None if not found."""
+    m = re.search(r'^[^\s#/].*\b%s\([^;\n]*$' % name, source, re.M)
+    if not m:
+        return None
+    start = source.index('{', m.end())
+    depth = 0
+    for end in range(start, len(source)):
+        if source[end] == '{':
+            depth += 1
+        elif source[end] == '}':
+            depth -= 1
+            if depth == 0:
+                return source[start:end + 1].split('\n')
+    return None
+
+
+def model_digest(source):
+    digest = hashlib.sha1()
+    for name in MODEL_FUNCTIONS:
+        body = function_body(source, name)
+        if body is None:
+            return None
+        digest.update(name.encode())
+        for line in body:
+            line = ' '.join(re.sub(r'//.*', '', line).split())
+            if MODEL_LINE.search(line) and not PRINT_LINE.match(line):
+                digest.update(line.encode() + b'\n')
+    return digest.hexdigest()[:12]
+
+
+def check_sources(root):
+    """Compare the tables and model with the C++ sources, returns a list of differences."""
+    helper = os.path.join(root, 'source', 'helpers', 'event_trace_helper.h')
+    main = os.path.join(root, 'source', 'main.cpp')
+    errors = []
+
+    def expect(what, ours, theirs):
+        if ours != theirs:
+            errors.append('%s: trace_replay.py has %s, the sources have %s' % (what, ours, theirs))
+
+    expect('EVENT_TRACE_VERSION', TRACE_VERSION, read_defines(helper, 'EVENT_TRACE_').get('VERSION'))
+    types = read_defines(helper, 'TRACE_TYPE_')
+    for name, value in (('EVENT', TYPE_EVENT), ('CALLBACK', TYPE_CALLBACK), ('SERIAL_COMMAND', TYPE_SERIAL_COMMAND),
+                        ('DOWNLINK_COMMAND', TYPE_DOWNLINK_COMMAND), ('BOOT', TYPE_BOOT)):
+        expect('TRACE_TYPE_' + name, value, types.get(name))
+    expect('record types', len(types), 5)
+    expect('event codes', EVENTS, dict((v, k) for k, v in read_defines(helper, 'TRACE_EV_').items()))
+    expect('callback codes', CALLBACKS, dict((v, k) for k, v in read_defines(helper, 'TRACE_CB_').items()))
+    flags = read_defines(helper, 'TRACE_FLAG_')
+    expect('state flags', dict((k[5:], v) for k, v in globals().items() if k.startswith('FLAG_') and
+                               isinstance(v, int)), flags)
+
+    with open(main) as f:
+        source = f.read()
+    opcodes = read_defines(main, '')
+    expect('SET_DEVICE_CLASS', SET_DEVICE_CLASS, opcodes.get('SET_DEVICE_CLASS'))
+    expect('SET_PING_SLOT_PERIODICITY', SET_PING_SLOT_PERIODICITY, opcodes.get('SET_PING_SLOT_PERIODICITY'))
+    expect('PING_SLOT_PERIODICITY_MAX', 7, opcodes.get('PING_SLOT_PERIODICITY_MAX'))
+
+    body = '\n'.join(function_body(source, 'app_trace_flags') or [])
+    expect('app_trace_flags() variables', FLAG_VARIABLES,
+           dict(re.findall(r'\((\w+) \? TRACE_FLAG_(\w+) : 0\)', body)))
+    expect('app_trace_flags() class bits', True, '(app_device_class & 0x03)' in body)
+
+    digest = model_digest(source)
+    if digest != MODEL_DIGEST:
+        errors.append('MODEL_DIGEST: the state handling of %s changed (digest %s), review AppModel' %
+                      (', '.join(MODEL_FUNCTIONS), digest))
+    return errors
+
+
+class Record(object):
+    __slots__ = ('time_ms', 'type', 'code', 'arg', 'flags')
+
+    def __init__(self, time_ms, type, code, arg, flags):
+        self.time_ms = time_ms
+        self.type = type
+        self.code = code
+        self.arg = arg
+        self.flags = flags
+
+    def name(self):
+        if self.type == TYPE_EVENT:
+            return EVENTS.get(self.code, 'EVENT_%u' % self.code)
+        if self.type == TYPE_CALLBACK:
+            return CALLBACKS.get(self.code, 'CALLBACK_%u' % self.code)
+        if self.type == TYPE_SERIAL_COMMAND:
+            return 'SERIAL_CMD_%02x(%02x)' % (self.code, self.arg)
+        if self.type == TYPE_DOWNLINK_COMMAND:
+            return 'DOWNLINK_CMD_%02x(%02x)' % (self.code, self.arg)
+        if self.type == TYPE_BOOT:
+            return 'BOOT v%u.%u' % (self.code, self.arg)
+        return 'TYPE_%u' % self.type
+
+
+def parse_traces(lines):
+    """Return a list of traces, each a list of Record."""
+    traces = []
+    current = None
+    for line in lines:
+        line = line.strip()
+        m = re.search(r'TRACE-BEGIN (\d+) (\d+) (\d+)', line)
+        if m:
+            if int(m.group(1)) != TRACE_VERSION:
+                raise ValueError('Unsupported trace version %s' % m.group(1))
+            current = []
+            continue
+        if 'TRACE-END' in line and current is not None:
+            traces.append(current)
+            current = None
+            continue
+        m = re.search(r'TRACE ([0-9a-fA-F]{16})', line)
+        if m and current is not None:
+            raw = bytes(bytearray.fromhex(m.group(1)))
+            current.append(Record(int(m.group(1)[:8], 16), raw[4], raw[5], raw[6], raw[7]))
+    return traces
+
+
+class AppModel(object):
+    """Class B state handling of source/main.cpp, assuming every stack call succeeds."""
+
+    def __init__(self, flags):
+        self.load(flags)
+
+    def load(self, flags):
+        self.device_class = flags & 0x03
+        self.class_b_on = bool(flags & FLAG_CLASS_B_ON)
+        self.beacon_acq_enabled = bool(flags & FLAG_BEACON_ACQ)
+        self.ping_slot_synched = bool(flags & FLAG_PING_SLOT_SYNCHED)
+        self.device_time_synched = bool(flags & FLAG_TIME_SYNCHED)
+        self.beacon_found = bool(flags & FLAG_BEACON_FOUND)
+
+    def flags(self):
+        return (self.device_class |
+                (FLAG_CLASS_B_ON if self.class_b_on else 0) |
+                (FLAG_BEACON_ACQ if self.beacon_acq_enabled else 0) |
+                (FLAG_PING_SLOT_SYNCHED if self.ping_slot_synched else 0) |
+                (FLAG_TIME_SYNCHED if self.device_time_synched else 0) |
+                (FLAG_BEACON_FOUND if self.beacon_found else 0))
+
+    def enable_beacon_acquisition(self):
+        if self.class_b_on:
+            return
+        self.beacon_found = False
+        if self.device_time_synched:
+            self.beacon_acq_enabled = True
+
+    def switch_to_class_b(self):
+        if self.device_class == CLASS_B and not self.class_b_on and self.beacon_found and self.ping_slot_synched:
+            self.class_b_on = True
+
+    def set_device_class(self, device_class):
+        if device_class in (CLASS_A, CLASS_C):
+            self.device_time_synched = False
+            self.class_b_on = False
+            self.beacon_acq_enabled = False
+        elif device_class == CLASS_B and self.ping_slot_synched:
+            self.enable_beacon_acquisition()
+        self.device_class = device_class
+
+    def apply(self, record):
+        if record.type == TYPE_EVENT:
+            event = EVENTS.get(record.code)
+            if event == 'CONNECTED':
+                self.set_device_class(self.device_class)
+            elif event == 'DEVICE_TIME_SYNCHED':
+                self.device_time_synched = True
+                if self.device_class == CLASS_B:
+                    self.enable_beacon_acquisition()
+            elif event == 'PING_SLOT_INFO_SYNCHED':
+                self.ping_slot_synched = True
+                if self.device_class == CLASS_B:
+                    self.enable_beacon_acquisition()
+            elif event == 'BEACON_NOT_FOUND':
+                if self.device_class == CLASS_B:
+                    self.enable_beacon_acquisition()
+            elif event == 'BEACON_FOUND':
+                self.beacon_found = True
+                self.switch_to_class_b()
+            elif event == 'SWITCH_CLASS_B_TO_A':
+                self.class_b_on = False
+                if self.device_class == CLASS_B:
+                    self.enable_beacon_acquisition()
+        elif record.type in (TYPE_SERIAL_COMMAND, TYPE_DOWNLINK_COMMAND):
+            if record.code == SET_DEVICE_CLASS and record.arg <= CLASS_C:
+                self.set_device_class(record.arg)
+            elif record.code == SET_PING_SLOT_PERIODICITY and record.arg <= 7:
+                self.ping_slot_synched = False
+
+
+def replay(records, verbose=False):
+    result = {
+        'records': len(records),
+        'divergences': [],
+        'events': {},
+        'class_b_on_ms': None,
+        'duration_ms': 0,
+    }
+    if not records:
+        return result
+
+    model = AppModel(records[0].flags)
+    start = records[0].time_ms
+    t0 = time.time()
+
+    for index, record in enumerate(records):
+        if record.flags != model.flags():
+            result['divergences'].append({
+                'index': index,
+                'time_ms': record.time_ms - start,
+                'before': records[index - 1].name() if index else None,
+                'expected': '%02x' % model.flags(),
+                'recorded': '%02x' % record.flags,
+            })
+            model.load(record.flags)
+
+        name = record.name()
+        result['events'][name] = result['events'].get(name, 0) + 1
+        if verbose:
+            print('%10u ms  %-28s flags=%02x' % (record.time_ms - start, name, record.flags))
+
+        model.apply(record)
+        if model.class_b_on and result['class_b_on_ms'] is None:
+            result['class_b_on_ms'] = record.time_ms - start
+
+    elapsed = time.time() - t0
+    result['duration_ms'] = records[-1].time_ms - start
+    result['replay_records_per_s'] = int(len(records) / elapsed) if elapsed > 0 else None
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('log', nargs='?', help='serial log containing one or more trace dumps')
+    parser.add_argument('--verbose', action='store_true', help='print every record')
+    parser.add_argument('--json', action='store_true', help='machine readable output')
+    parser.add_argument('--check', action='store_true', help='only check the model against the sources')
+    parser.add_argument('--source', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'),
+                        help='application source tree (default: this repository)')
+    args = parser.parse_args()
+
+    if not os.path.exists(os.path.join(args.source, 'source', 'main.cpp')):
+        if args.check:
+            sys.exit('No application sources in %s' % args.source)
+        sys.stderr.write('Application sources not found, the model is not checked\n')
+    else:
+        errors = check_sources(args.source)
+        for error in errors:
+            sys.stderr.write('Model drift: %s\n' % error)
+        if errors:
+            sys.exit(2)
+    if args.check:
+        return
+    if not args.log:
+        parser.error('log is required')
+
+    with open(args.log) as f:
+        traces = parse_traces(f)
+
+    if not traces:
+        sys.exit('No trace found in %s' % args.log)
+
+    results = [replay(records, args.verbose) for records in traces]
+
+    if args.json:
+        print(json.dumps(results, indent=2))
+    else:
+        for i, r in enumerate(results):
+            print('Trace %d: %d records over %u ms, %d divergences' %
+                  (i, r['records'], r['duration_ms'], len(r['divergences'])))
+            if r['class_b_on_ms'] is not None:
+                print('  Class B on after %u ms' % r['class_b_on_ms'])
+            for name in sorted(r['events']):
+                print('  %-28s %u' % (name, r['events'][name]))
+            for d in r['divergences']:
+                print('  Divergence at record %u (%u ms) after %s: expected flags %s, recorded %s' %
+                      (d['index'], d['time_ms'], d['before'], d['expected'], d['recorded']))
+
+    sys.exit(1 if any(r['divergences'] for r in results) else 0)
+
+
+if __name__ == '__main__':
+    main()